@@ -8,12 +8,33 @@ CONFIG -= console
 TARGET = lorentz
 
 HEADERS = src/model.h \
+          src/ensemble.h \
+          src/topology.h \
+          src/hugepages.h \
+          src/historyfile.h \
+          src/ringbuffer.h \
+          src/compressedhistory.h \
+          src/statistics.h \
+          src/averages.h \
+          src/correlator.h \
+          src/sampling.h \
+          src/pyramid.h \
+          src/equilibrium.h \
+          src/headless.h \
           src/widget.h \
           src/window.h \
           src/qcustomplot.h \
     src/aboutdialog.h
 
 SOURCES = src/model.cpp \
+          src/ensemble.cpp \
+          src/topology.cpp \
+          src/hugepages.cpp \
+          src/historyfile.cpp \
+          src/compressedhistory.cpp \
+          src/correlator.cpp \
+          src/equilibrium.cpp \
+          src/headless.cpp \
           src/main.cpp \
           src/widget.cpp \
           src/window.cpp \
@@ -27,6 +48,20 @@ TRANSLATIONS = translations/lorentz_ru.ts
 
 RESOURCES += resources.qrc
 
+# qmake CONFIG+=numa: take the NUMA topology from libnuma
+numa {
+    DEFINES += HAVE_LIBNUMA
+    LIBS += -lnuma
+}
+
+# qmake CONFIG+=mpi: headless runs spread the ensemble over MPI ranks,
+#   mpirun -np 4 ./lorentz --headless --members 100000
+mpi {
+    DEFINES += LORENTZ_MPI
+    QMAKE_CXX = mpicxx
+    QMAKE_LINK = mpicxx
+}
+
 
 
 
@@ -0,0 +1,123 @@
+#ifndef AVERAGES_H
+#define AVERAGES_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QDataStream>
+
+// Time average of a sampled signal, updated in O(1) per sample.
+//   Cumulative  - mean of every sample so far
+//   Sliding     - mean of the last window samples
+//   Exponential - exponentially weighted mean with smoothing factor alpha
+class TimeAverage
+{
+public:
+	enum Mode { Cumulative, Sliding, Exponential };
+
+	TimeAverage() : mode(Cumulative), window(100), alpha(0.05) { clear(); }
+
+	void setCumulative()
+	{
+		mode = Cumulative;
+		clear();
+	}
+
+	void setSliding(int samples)
+	{
+		mode = Sliding;
+		window = qMax(1, samples);
+		clear();
+	}
+
+	void setExponential(qreal factor)
+	{
+		mode = Exponential;
+		alpha = factor;
+		clear();
+	}
+
+	Mode getMode() const { return mode; }
+
+	void clear()
+	{
+		n = 0;
+		sum = 0;
+		current = 0;
+		next = 0;
+		recent.clear();
+	}
+
+	qreal add(qreal x)
+	{
+		n++;
+		switch (mode) {
+		case Cumulative:
+			current += (x - current) / n;
+			break;
+		case Sliding:
+			if (recent.size() < window) {
+				recent.append(x);
+				sum += x;
+			}
+			else {
+				sum += x - recent[next];
+				recent[next] = x;
+				next = (next + 1) % window;
+				// resum once per window to keep rounding errors from piling up
+				if (next == 0) {
+					sum = 0;
+					for (int i = 0; i < window; i++)
+						sum += recent[i];
+				}
+			}
+			current = sum / recent.size();
+			break;
+		case Exponential:
+			current = n == 1 ? x : current + alpha * (x - current);
+			break;
+		}
+		return current;
+	}
+
+	// The whole state, for checkpoints.
+	void saveState(QDataStream& out) const
+	{
+		out << int(mode) << window << alpha << n << sum << current << next << recent;
+	}
+
+	void loadState(QDataStream& in)
+	{
+		int m;
+		in >> m >> window >> alpha >> n >> sum >> current >> next >> recent;
+		mode = Mode(m);
+	}
+
+	qreal value() const { return current; }
+	qint64 count() const { return n; }
+
+	// Number of samples the current value effectively averages over.
+	qreal span() const
+	{
+		switch (mode) {
+		case Sliding:
+			return recent.size();
+		case Exponential:
+			return qMin<qreal>(n, (2 - alpha) / alpha);
+		default:
+			return n;
+		}
+	}
+
+private:
+	Mode mode;
+	int window;
+	qreal alpha;
+
+	qint64 n;
+	qreal sum;
+	qreal current;
+	int next;
+	QVector<qreal> recent;
+};
+
+#endif
@@ -0,0 +1,414 @@
+#include <QtGlobal>
+#include "compressedhistory.h"
+
+#include <string.h>
+
+class BitWriter
+{
+public:
+	BitWriter() : word(0), used(0) {}
+
+	void write(quint64 value, int n)
+	{
+		if (n < 64)
+			value &= (quint64(1) << n) - 1;
+		while (n > 0) {
+			int take = qMin(n, 64 - used);
+			quint64 part = value >> (n - take);
+			if (take < 64)
+				part &= (quint64(1) << take) - 1;
+			word = take == 64 ? part : (word << take) | part;
+			used += take;
+			n -= take;
+			if (used == 64)
+				flush();
+		}
+	}
+
+	QByteArray finish()
+	{
+		if (used > 0) {
+			word <<= 64 - used;
+			flush();
+		}
+		return bytes;
+	}
+
+private:
+	void flush()
+	{
+		char out[8];
+		for (int i = 0; i < 8; i++)
+			out[i] = char(word >> (56 - 8 * i));
+		bytes.append(out, 8);
+		word = 0;
+		used = 0;
+	}
+
+	QByteArray bytes;
+	quint64 word;
+	int used;
+};
+
+class BitReader
+{
+public:
+	BitReader(const QByteArray& bytes) : data((const uchar *)bytes.constData()), size(bytes.size()), pos(0) {}
+
+	quint64 read(int n)
+	{
+		quint64 value = 0;
+		while (n > 0) {
+			int byte = int(pos >> 3);
+			int offset = int(pos & 7);
+			int take = qMin(n, 8 - offset);
+			uint bits = byte < size ? data[byte] : 0;
+			bits = (bits >> (8 - offset - take)) & ((1u << take) - 1);
+			value = (value << take) | bits;
+			pos += take;
+			n -= take;
+		}
+		return value;
+	}
+
+	bool bit() { return read(1) != 0; }
+
+private:
+	const uchar *data;
+	int size;
+	qint64 pos;
+};
+
+static quint64 bitsOf(qreal x)
+{
+	quint64 b;
+	memcpy(&b, &x, sizeof(b));
+	return b;
+}
+
+static qreal valueOf(quint64 b)
+{
+	qreal x;
+	memcpy(&x, &b, sizeof(x));
+	return x;
+}
+
+static int leadingZeros(quint64 x)
+{
+#if defined(Q_CC_GNU)
+	return __builtin_clzll(x);
+#else
+	int n = 0;
+	for (quint64 m = quint64(1) << 63; !(x & m); m >>= 1)
+		n++;
+	return n;
+#endif
+}
+
+static int trailingZeros(quint64 x)
+{
+#if defined(Q_CC_GNU)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	for (; !(x & 1); x >>= 1)
+		n++;
+	return n;
+#endif
+}
+
+// Control bits per value: 0 for a repeat; 10 plus the meaningful bits when
+// they fit in the previous window of leading/trailing zeros; otherwise 11,
+// 5 bits of leading zeros, 6 bits of length and the meaningful bits.
+static void encodeXor(BitWriter& out, const qreal *values, int n)
+{
+	quint64 prev = bitsOf(values[0]);
+	out.write(prev, 64);
+	int lead = -1, trail = 0;
+	for (int i = 1; i < n; i++) {
+		quint64 b = bitsOf(values[i]);
+		quint64 x = b ^ prev;
+		prev = b;
+		if (x == 0) {
+			out.write(0, 1);
+			continue;
+		}
+		int l = qMin(leadingZeros(x), 31);
+		int t = trailingZeros(x);
+		if (lead >= 0 && l >= lead && t >= trail) {
+			out.write(2, 2);
+			out.write(x >> trail, 64 - lead - trail);
+		}
+		else {
+			lead = l;
+			trail = t;
+			out.write(3, 2);
+			out.write(lead, 5);
+			out.write(64 - lead - trail - 1, 6);
+			out.write(x >> trail, 64 - lead - trail);
+		}
+	}
+}
+
+static void decodeXor(BitReader& in, qreal *values, int n)
+{
+	quint64 prev = in.read(64);
+	values[0] = valueOf(prev);
+	int lead = 0, trail = 0;
+	for (int i = 1; i < n; i++) {
+		if (in.bit()) {
+			if (in.bit()) {
+				lead = int(in.read(5));
+				trail = 64 - lead - (int(in.read(6)) + 1);
+			}
+			prev ^= in.read(64 - lead - trail) << trail;
+		}
+		values[i] = valueOf(prev);
+	}
+}
+
+// The bit patterns of increasing positive doubles increase too; their
+// second differences are zigzag coded into 0, 10 + 7 bits, 110 + 9 bits,
+// 1110 + 12 bits or 1111 + 64 bits.
+static void encodeDeltaOfDelta(BitWriter& out, const qreal *values, int n)
+{
+	quint64 prev = bitsOf(values[0]);
+	out.write(prev, 64);
+	quint64 delta = 0;
+	for (int i = 1; i < n; i++) {
+		quint64 b = bitsOf(values[i]);
+		quint64 d = b - prev;
+		qint64 dod = qint64(d - delta);
+		quint64 zz = (quint64(dod) << 1) ^ quint64(dod >> 63);
+		if (zz == 0)
+			out.write(0, 1);
+		else if (zz < (1 << 7)) {
+			out.write(2, 2);
+			out.write(zz, 7);
+		}
+		else if (zz < (1 << 9)) {
+			out.write(6, 3);
+			out.write(zz, 9);
+		}
+		else if (zz < (1 << 12)) {
+			out.write(14, 4);
+			out.write(zz, 12);
+		}
+		else {
+			out.write(15, 4);
+			out.write(zz, 64);
+		}
+		prev = b;
+		delta = d;
+	}
+}
+
+static void decodeDeltaOfDelta(BitReader& in, qreal *values, int n)
+{
+	quint64 prev = in.read(64);
+	values[0] = valueOf(prev);
+	quint64 delta = 0;
+	for (int i = 1; i < n; i++) {
+		quint64 zz = 0;
+		if (!in.bit())
+			zz = 0;
+		else if (!in.bit())
+			zz = in.read(7);
+		else if (!in.bit())
+			zz = in.read(9);
+		else if (!in.bit())
+			zz = in.read(12);
+		else
+			zz = in.read(64);
+		quint64 dod = (zz >> 1) ^ (~(zz & 1) + 1);
+		delta += dod;
+		prev += delta;
+		values[i] = valueOf(prev);
+	}
+}
+
+QByteArray encodeBlock(const qreal *values, int n, HistoryCodec codec)
+{
+	BitWriter out;
+	if (n <= 0)
+		return QByteArray();
+	if (codec == XorCodec)
+		encodeXor(out, values, n);
+	else
+		encodeDeltaOfDelta(out, values, n);
+	return out.finish();
+}
+
+void decodeBlock(const QByteArray& bits, int n, HistoryCodec codec, qreal *values)
+{
+	BitReader in(bits);
+	if (n <= 0)
+		return;
+	if (codec == XorCodec)
+		decodeXor(in, values, n);
+	else
+		decodeDeltaOfDelta(in, values, n);
+}
+
+
+CompressedView::CompressedView()
+	: history(NULL), count(0), cached(-1)
+{
+}
+
+CompressedView::CompressedView(const CompressedHistory *h)
+	: history(h), count(h->size()), cached(-1)
+{
+	if (h->isMapped())
+		mapped = h->raw.view();
+	else
+		h->pins.ref();
+}
+
+CompressedView::CompressedView(const CompressedView& other)
+	: history(other.history), mapped(other.mapped), count(other.count), cached(-1)
+{
+	if (history && !history->isMapped())
+		history->pins.ref();
+}
+
+CompressedView& CompressedView::operator=(const CompressedView& other)
+{
+	if (other.history && !other.history->isMapped())
+		other.history->pins.ref();
+	if (history && !history->isMapped())
+		history->pins.deref();
+	history = other.history;
+	mapped = other.mapped;
+	count = other.count;
+	cached = -1;
+	return *this;
+}
+
+CompressedView::~CompressedView()
+{
+	if (history && !history->isMapped())
+		history->pins.deref();
+}
+
+qreal CompressedView::operator[](int i) const
+{
+	if (!mapped.isEmpty())
+		return mapped[i];
+	int b = i / CompressedHistory::BLOCK;
+	int k = i % CompressedHistory::BLOCK;
+	if (b == history->blocks.size())
+		return history->tail[k];
+	if (b != cached) {
+		cache.resize(CompressedHistory::BLOCK);
+		decodeBlock(history->blocks[b], CompressedHistory::BLOCK, history->codec, cache.data());
+		cached = b;
+	}
+	return cache[k];
+}
+
+
+CompressedHistory::CompressedHistory(HistoryCodec codec, int capacity)
+	: codec(codec), cap(capacity), sealedBytes(0), pins(0)
+{
+}
+
+CompressedHistory::CompressedHistory(const CompressedHistory& other)
+	: codec(other.codec), cap(other.cap), blocks(other.blocks), tail(other.tail),
+	sealedBytes(other.sealedBytes), raw(other.raw), pins(0)
+{
+}
+
+CompressedHistory& CompressedHistory::operator=(const CompressedHistory& other)
+{
+	Q_ASSERT(pins.loadAcquire() == 0);
+	codec = other.codec;
+	cap = other.cap;
+	blocks = other.blocks;
+	tail = other.tail;
+	sealedBytes = other.sealedBytes;
+	raw = other.raw;
+	return *this;
+}
+
+void CompressedHistory::setCapacity(int capacity)
+{
+	cap = capacity;
+	raw.setCapacity(capacity);
+	clear();
+}
+
+void CompressedHistory::shrink(int capacity)
+{
+	Q_ASSERT(pins.loadAcquire() == 0);
+	if (capacity >= cap)
+		return;
+	cap = capacity;
+	raw.shrink(capacity);
+	while (size() > cap && !blocks.isEmpty() && !raw.isMapped()) {
+		sealedBytes -= blocks.first().size();
+		blocks.removeFirst();
+	}
+}
+
+bool CompressedHistory::mapTo(const QString& path)
+{
+	Q_ASSERT(pins.loadAcquire() == 0);
+	clear();
+	return raw.mapTo(path);
+}
+
+int CompressedHistory::size() const
+{
+	if (raw.isMapped())
+		return raw.size();
+	return blocks.size() * BLOCK + tail.size();
+}
+
+void CompressedHistory::clear()
+{
+	Q_ASSERT(pins.loadAcquire() == 0);
+	blocks.clear();
+	tail.clear();
+	sealedBytes = 0;
+	raw.clear();
+}
+
+void CompressedHistory::append(qreal value)
+{
+	Q_ASSERT(pins.loadAcquire() == 0);
+	if (raw.isMapped()) {
+		raw.append(value);
+		return;
+	}
+	if (cap <= 0)
+		return;
+	tail.append(value);
+	if (tail.size() == BLOCK) {
+		QByteArray sealed = encodeBlock(tail.constData(), BLOCK, codec);
+		sealedBytes += sealed.size();
+		blocks.append(sealed);
+		tail.clear();
+		tail.reserve(BLOCK);
+	}
+	if (size() > cap && !blocks.isEmpty()) {
+		sealedBytes -= blocks.first().size();
+		blocks.removeFirst();
+	}
+}
+
+qreal CompressedHistory::last() const
+{
+	if (raw.isMapped())
+		return raw.last();
+	if (!tail.isEmpty())
+		return tail.last();
+	return view().last();
+}
+
+qint64 CompressedHistory::bytes() const
+{
+	if (raw.isMapped())
+		return raw.bytes();
+	return sealedBytes + tail.capacity() * sizeof(qreal);
+}
@@ -0,0 +1,102 @@
+#ifndef COMPRESSEDHISTORY_H
+#define COMPRESSEDHISTORY_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QList>
+#include <QByteArray>
+#include <QAtomicInt>
+
+#include "ringbuffer.h"
+
+// Lossless codecs for blocks of smooth samples:
+//   XorCodec          - Gorilla-style XOR of every value with the previous
+//                       one, for slowly changing values such as pressures
+//   DeltaOfDeltaCodec - delta of delta of the bit patterns, for increasing
+//                       and nearly evenly spaced values such as times
+enum HistoryCodec {
+	XorCodec,
+	DeltaOfDeltaCodec
+};
+
+QByteArray encodeBlock(const qreal *values, int n, HistoryCodec codec);
+void decodeBlock(const QByteArray& bits, int n, HistoryCodec codec, qreal *values);
+
+class CompressedHistory;
+
+// Read-only view of a CompressedHistory, valid like a HistoryView only
+// until the history next changes. It decodes one block at a time and keeps the last one, so reading forward
+// costs a block decode per BLOCK samples.
+class CompressedView
+{
+public:
+	typedef qreal value_type;
+
+	CompressedView();
+	CompressedView(const CompressedHistory *history);
+	CompressedView(const CompressedView& other);
+	CompressedView& operator=(const CompressedView& other);
+	~CompressedView();
+
+	int size() const { return count; }
+	bool isEmpty() const { return count == 0; }
+
+	qreal operator[](int i) const;
+	qreal first() const { return (*this)[0]; }
+	qreal last() const { return (*this)[count - 1]; }
+
+private:
+	const CompressedHistory *history;
+	HistoryView<qreal> mapped;	// when the history is kept in a file
+	int count;
+
+	mutable int cached;		// block held in cache, -1 for none
+	mutable QVector<qreal> cache;
+};
+
+// History of at most capacity samples kept as sealed, compressed blocks of
+// BLOCK samples plus the open tail block. Once full, the oldest block is
+// dropped. A history moved to a file with mapTo() is stored there as plain
+// records, uncompressed.
+class CompressedHistory
+{
+public:
+	static const int BLOCK = 1024;
+
+	explicit CompressedHistory(HistoryCodec codec = XorCodec, int capacity = 0);
+	CompressedHistory(const CompressedHistory& other);
+	CompressedHistory& operator=(const CompressedHistory& other);
+
+	void setCapacity(int capacity);
+	// Lowers the capacity dropping the oldest blocks.
+	void shrink(int capacity);
+	bool mapTo(const QString& path);
+	bool isMapped() const { return raw.isMapped(); }
+
+	int size() const;
+	bool isEmpty() const { return size() == 0; }
+
+	void clear();
+	void append(qreal value);
+
+	qreal first() const { return view().first(); }
+	qreal last() const;
+
+	CompressedView view() const { return CompressedView(this); }
+
+	// Bytes of RAM held by the samples, compressed or not.
+	qint64 bytes() const;
+
+private:
+	friend class CompressedView;
+
+	HistoryCodec codec;
+	int cap;
+	QList<QByteArray> blocks;	// sealed, oldest first
+	QVector<qreal> tail;		// open block
+	qint64 sealedBytes;
+	RingBuffer<qreal> raw;		// used instead when mapped to a file
+	mutable QAtomicInt pins;	// live views
+};
+
+#endif
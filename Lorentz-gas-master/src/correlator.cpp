@@ -0,0 +1,133 @@
+#include <QtGlobal>
+#include <QtMath>
+#include "correlator.h"
+
+#include <string.h>
+
+const qreal MultiTauCorrelator::WINDOW = 5.0;
+
+void MultiTauCorrelator::clear()
+{
+	levels.clear();
+	n = 0;
+	offset = 0;
+	sum = 0;
+	sum2 = 0;
+}
+
+void MultiTauCorrelator::add(qreal x)
+{
+	if (n == 0)
+		offset = x;
+	x -= offset;
+	n++;
+	sum += x;
+	sum2 += x * x;
+	push(0, x);
+}
+
+void MultiTauCorrelator::push(int k, qreal x)
+{
+	if (k == levels.size()) {
+		Level level;
+		memset(&level, 0, sizeof(level));
+		levels.append(level);
+	}
+	Level& level = levels[k];
+	level.head = (level.head + CHANNELS - 1) % CHANNELS;
+	level.shift[level.head] = x;
+	level.filled = qMin(level.filled + 1, int(CHANNELS));
+
+	// the lags below CHANNELS / AVERAGE are covered by the finer levels
+	for (int j = k == 0 ? 0 : CHANNELS / AVERAGE; j < level.filled; j++) {
+		level.products[j] += x * level.shift[(level.head + j) % CHANNELS];
+		level.pairs[j]++;
+	}
+
+	level.accumulator += x;
+	if (++level.accumulated == AVERAGE) {
+		qreal coarse = level.accumulator / AVERAGE;
+		level.accumulator = 0;
+		level.accumulated = 0;
+		push(k + 1, coarse);
+	}
+}
+
+qreal MultiTauCorrelator::mean() const
+{
+	return n > 0 ? offset + sum / n : 0;
+}
+
+qreal MultiTauCorrelator::variance() const
+{
+	if (n == 0)
+		return 0;
+	qreal m = sum / n;
+	return qMax<qreal>(sum2 / n - m * m, 0);
+}
+
+void MultiTauCorrelator::autocorrelation(QVector<qreal>& lags, QVector<qreal>& rho) const
+{
+	lags.clear();
+	rho.clear();
+	qreal var = variance();
+	if (var <= 0)
+		return;
+	qreal m = sum / n;
+	qint64 scale = 1;
+	for (int k = 0; k < levels.size(); k++, scale *= AVERAGE) {
+		const Level& level = levels[k];
+		for (int j = k == 0 ? 0 : CHANNELS / AVERAGE; j < CHANNELS; j++) {
+			if (level.pairs[j] == 0)
+				break;
+			lags.append(qreal(j * scale));
+			rho.append((level.products[j] / level.pairs[j] - m * m) / var);
+		}
+	}
+}
+
+qreal MultiTauCorrelator::integratedTime() const
+{
+	QVector<qreal> lags, rho;
+	autocorrelation(lags, rho);
+	// trapezoids between the lags; on evenly spaced lags this is the usual
+	// 1/2 + sum of rho, up to half the last term
+	qreal tau = 0;
+	for (int i = 1; i < lags.size(); i++) {
+		tau += (rho[i - 1] + rho[i]) / 2 * (lags[i] - lags[i - 1]);
+		if (lags[i] >= WINDOW * tau)
+			break;
+	}
+	return qMax<qreal>(tau, 0.5);
+}
+
+qreal MultiTauCorrelator::standardError(qreal samples) const
+{
+	if (samples <= 0)
+		return 0;
+	return qSqrt(variance() * 2 * integratedTime() / samples);
+}
+
+void MultiTauCorrelator::saveState(QDataStream& out) const
+{
+	out << n << offset << sum << sum2 << levels.size();
+	for (int k = 0; k < levels.size(); k++) {
+		const Level& level = levels[k];
+		for (int j = 0; j < CHANNELS; j++)
+			out << level.shift[j] << level.products[j] << level.pairs[j];
+		out << level.head << level.filled << level.accumulator << level.accumulated;
+	}
+}
+
+void MultiTauCorrelator::loadState(QDataStream& in)
+{
+	int count;
+	in >> n >> offset >> sum >> sum2 >> count;
+	levels.resize(count);
+	for (int k = 0; k < count; k++) {
+		Level& level = levels[k];
+		for (int j = 0; j < CHANNELS; j++)
+			in >> level.shift[j] >> level.products[j] >> level.pairs[j];
+		in >> level.head >> level.filled >> level.accumulator >> level.accumulated;
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef CORRELATOR_H
+#define CORRELATOR_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QDataStream>
+
+// Autocorrelation of an evenly sampled signal over lags spread
+// logarithmically (a multi-tau correlator). Level 0 correlates the samples
+// themselves at lags 0 to CHANNELS - 1; every further level is fed the mean
+// of AVERAGE values of the previous one and covers lags AVERAGE times
+// longer. Levels are added as the signal grows, so T samples take
+// O(log T) memory, and an add costs O(CHANNELS) amortized.
+class MultiTauCorrelator
+{
+public:
+	enum { CHANNELS = 16, AVERAGE = 2 };
+	// Sokal's window: the lag sum stops at WINDOW correlation times.
+	static const qreal WINDOW;
+
+	MultiTauCorrelator() { clear(); }
+
+	void clear();
+	void add(qreal x);
+
+	qint64 count() const { return n; }
+	qreal mean() const;
+	qreal variance() const;
+
+	// Normalised autocorrelation at every lag with data, in samples.
+	void autocorrelation(QVector<qreal>& lags, QVector<qreal>& rho) const;
+	// Integrated autocorrelation time in samples, 1/2 for white noise.
+	qreal integratedTime() const;
+	// Standard error of the mean of the last samples of the signal.
+	qreal standardError(qreal samples) const;
+
+	// The whole state, for checkpoints.
+	void saveState(QDataStream& out) const;
+	void loadState(QDataStream& in);
+
+private:
+	struct Level
+	{
+		qreal shift[CHANNELS];	// newest value at head
+		int head;
+		int filled;
+		qreal products[CHANNELS];
+		qint64 pairs[CHANNELS];
+		qreal accumulator;
+		int accumulated;
+	};
+
+	void push(int k, qreal x);
+
+	QVector<Level> levels;
+	qint64 n;
+	qreal offset;		// first sample, subtracted to keep the sums small
+	qreal sum;
+	qreal sum2;
+};
+
+#endif
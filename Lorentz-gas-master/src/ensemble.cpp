@@ -0,0 +1,749 @@
+#include <QtGlobal>
+#include <QDir>
+#include <QCoreApplication>
+#include "ensemble.h"
+#include "model.h"
+#include "historyfile.h"
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+static qint64 physicalMemory()
+{
+#if defined(Q_OS_UNIX) && defined(_SC_PHYS_PAGES)
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long page = sysconf(_SC_PAGESIZE);
+	if (pages > 0 && page > 0)
+		return qint64(pages) * page;
+#endif
+	return qint64(4) << 30;
+}
+
+EnsembleWorker::EnsembleWorker(Ensemble *owner, int index, int node, int cpu, int generation)
+	: owner(owner), index(index), node(node), cpu(cpu), generation(generation)
+{
+}
+
+void EnsembleWorker::run()
+{
+	int wanted = cpu.loadAcquire();
+	if (wanted >= 0 && !pinCurrentThread(wanted))
+		cpu.storeRelease(-1);
+	owner->workerLoop(index, generation);
+}
+
+Ensemble::Ensemble()
+{
+	width = 0;
+	height = 0;
+	job = NULL;
+	generation = 0;
+	pending = 0;
+	active = 0;
+	scheduler = MeasurementScheduler(Model::measurePeriod);
+	scheduler.setRate(MeasurementScheduler::defaultRate());
+	time = CompressedHistory(DeltaOfDeltaCodec);
+	time.setCapacity(Model::MAX_HISTORY);
+	stats.setCapacity(Model::MAX_HISTORY);
+	stats.setEvictionUnit(CompressedHistory::BLOCK);
+	timeLevels.setCapacity(Model::MAX_HISTORY);
+	meanLevels.setCapacity(Model::MAX_HISTORY);
+	quantiles.setCapacity(Model::MAX_HISTORY);
+	quantiles.setEvictionUnit(CompressedHistory::BLOCK);
+	entropyMeans.setCapacity(Model::MAX_HISTORY);
+	entropyMeanLevels.setCapacity(Model::MAX_HISTORY);
+	isotropyMeans.setCapacity(Model::MAX_HISTORY);
+	isotropyMeanLevels.setCapacity(Model::MAX_HISTORY);
+	for (int q = 0; q < Quantiles::Count; q++)
+		quantileLevels[q].setCapacity(Model::MAX_HISTORY);
+	divergence.setCapacity(Model::MAX_HISTORY);
+	divergence.setEvictionUnit(CompressedHistory::BLOCK);
+	for (int k = 0; k < Divergence::Count; k++)
+		divergenceLevels[k].setCapacity(Model::MAX_HISTORY);
+	seed = 1;
+	taken = 0;
+	equilibrated = 0;
+	// like --equilibrated, a fraction in (0, 1]; anything else is ignored
+	bool valid;
+	equilibratedFraction = qgetenv("LORENTZ_EQUILIBRATED").toDouble(&valid);
+	if (!valid || equilibratedFraction <= 0 || equilibratedFraction > 1)
+		equilibratedFraction = 0.9;
+	QByteArray tolerance = qgetenv("LORENTZ_ERGODICITY_TOLERANCE");
+	ergodicityTolerance = tolerance.isEmpty() ? 0.03 : tolerance.toDouble();
+	binsNumber = 0;
+	angleBins = 0;
+	Signal preferred;
+	signal = signalFromName(QString::fromLocal8Bit(qgetenv("LORENTZ_EQUILIBRIUM_SIGNAL")), &preferred)
+		? preferred : Pressure;
+	historyCapacity = Model::MAX_HISTORY;
+	historyBytes = 0;
+	QByteArray budget = qgetenv("LORENTZ_HISTORY_BUDGET");
+	historyBudget = budget.isEmpty() ? physicalMemory() / 4 : budget.toLongLong() << 20;
+
+	// LORENTZ_CPUS restricts the workers to a CPU list ("0-7,16-23"),
+	// LORENTZ_PIN=0/1 turns pinning off/on. By default the workers are
+	// pinned only on machines with more than one NUMA node.
+	QVector<int> cpus = parseCpuList(QString::fromLocal8Bit(qgetenv("LORENTZ_CPUS")));
+	QByteArray pin = qgetenv("LORENTZ_PIN");
+	configure(cpus, pin.isEmpty() ? detectTopology().size() > 1 : pin != "0");
+
+	// LORENTZ_HISTORY_DIR moves the histories out of RAM
+	static int ensembles = 0;
+	QString dir = historyDirectory();
+	if (!dir.isEmpty())
+		setHistoryDirectory(dir, QString("lorentz-%1-%2").arg(QCoreApplication::applicationPid()).arg(ensembles++));
+}
+
+Ensemble::~Ensemble()
+{
+	// not setSize(0), which would also empty the history files
+	runJob([this](int w) {
+		for (int i = w; i < models.size(); i += workers.size())
+			delete models[i];
+	});
+	models.clear();
+	resizeWorkers(0);
+}
+
+void Ensemble::configure(const QVector<int>& cpus, bool pin)
+{
+	Q_ASSERT(models.isEmpty());
+	resizeWorkers(0);
+
+	QVector<NumaNode> nodes = restrictTopology(detectTopology(), cpus);
+	if (nodes.isEmpty())
+		nodes = detectTopology();
+	topology = nodes;
+
+	// interleave the nodes so that consecutive members land on different ones
+	places.clear();
+	for (int k = 0; ; k++) {
+		bool added = false;
+		for (int n = 0; n < nodes.size(); n++) {
+			if (k >= nodes[n].cpus.size())
+				continue;
+			Place place = { nodes[n].id, pin ? nodes[n].cpus[k] : -1 };
+			places.append(place);
+			added = true;
+		}
+		if (!added)
+			break;
+	}
+}
+
+// Starts or stops workers at the end of the line until count of them run.
+void Ensemble::resizeWorkers(int count)
+{
+	count = qMin(count, places.size());
+	mutex.lock();
+	active = count;
+	jobReady.wakeAll();
+	mutex.unlock();
+	for (int i = count; i < workers.size(); i++) {
+		workers[i]->wait();
+		delete workers[i];
+	}
+	if (count < workers.size())
+		workers.resize(count);
+	for (int i = workers.size(); i < count; i++) {
+		workers.append(new EnsembleWorker(this, i, places[i].node, places[i].cpu, generation));
+		workers[i]->start();
+	}
+}
+
+void Ensemble::workerLoop(int index, int seen)
+{
+	mutex.lock();
+	for (;;) {
+		while (generation == seen && index < active)
+			jobReady.wait(&mutex);
+		if (index >= active)
+			break;
+		seen = generation;
+		const std::function<void(int)> *current = job;
+		mutex.unlock();
+		(*current)(index);
+		mutex.lock();
+		if (--pending == 0)
+			jobDone.wakeAll();
+	}
+	mutex.unlock();
+}
+
+// Runs f(worker index) on every worker and waits for all of them.
+void Ensemble::runJob(const std::function<void(int)>& f)
+{
+	mutex.lock();
+	job = &f;
+	pending = workers.size();
+	generation++;
+	jobReady.wakeAll();
+	while (pending > 0)
+		jobDone.wait(&mutex);
+	job = NULL;
+	mutex.unlock();
+}
+
+void Ensemble::setDim(int w, int h)
+{
+	width = w;
+	height = h;
+}
+
+// Members are only comparable sample by sample, so resizing restarts the
+// measurement of the whole ensemble.
+void Ensemble::setSize(int size)
+{
+	int old = models.size();
+	if (size != old)
+		clear();
+	if (size < old) {
+		runJob([this, size, old](int w) {
+			for (int i = size; i < old; i++)
+				if (getOwner(i) == w)
+					delete models[i];
+		});
+		models.resize(size);
+		resizeWorkers(size);
+		return;
+	}
+
+	int added = old;
+	resizeWorkers(size);
+	models.resize(size);
+	if (old == 0 && size > 0) {
+		runJob([this](int w) {
+			if (getOwner(0) == w) {
+				models[0] = new Model();
+				models[0]->setSeed(seed);
+				models[0]->setDim(width, height);
+				models[0]->setBinsNumber(binsNumber);
+				models[0]->setAngleBinsNumber(angleBins);
+			}
+		});
+		old = 1;
+	}
+	// new members copy the settings of the first one
+	const Model *prototype = size > 0 ? models[0] : NULL;
+	runJob([this, prototype, old, size](int w) {
+		for (int i = old; i < size; i++)
+			if (getOwner(i) == w)
+				models[i] = new Model(*prototype, seed + i);
+	});
+	if (!historyPrefix.isEmpty())
+		mapHistories(added);
+}
+
+void Ensemble::setSeed(int value)
+{
+	seed = value;
+	forEachMember([value](int i, Model *model) {
+		model->setSeed(value + i);
+	});
+}
+
+// Moves the histories of the members from the given one on to files.
+void Ensemble::mapHistories(int from)
+{
+	QString prefix = historyPrefix;
+	forEachMember([prefix, from](int i, Model *model) {
+		if (i >= from)
+			model->mapHistory(QString("%1-m%2").arg(prefix).arg(i));
+	});
+}
+
+void Ensemble::setHistoryDirectory(const QString& dir, const QString& name)
+{
+	clear();
+	if (dir.isEmpty()) {
+		historyPrefix.clear();
+		return;
+	}
+	historyPrefix = QDir(dir).filePath(name);
+	time.mapTo(historyPrefix + "-time.hist");
+	stats.mapTo(historyPrefix + "-stats.hist");
+	quantiles.mapTo(historyPrefix + "-quantiles.hist");
+	divergence.mapTo(historyPrefix + "-divergence.hist");
+	entropyMeans.mapTo(historyPrefix + "-entropy.hist");
+	isotropyMeans.mapTo(historyPrefix + "-isotropy.hist");
+	for (int b = 0; b < binMeans.size(); b++)
+		binMeans[b].mapTo(QString("%1-bin%2.hist").arg(historyPrefix).arg(b));
+	mapHistories(0);
+}
+
+void Ensemble::forEach(const std::function<void(Model*)>& f)
+{
+	runJob([this, &f](int w) {
+		for (int i = w; i < models.size(); i += workers.size())
+			f(models[i]);
+	});
+}
+
+void Ensemble::forEachMember(const std::function<void(int, Model*)>& f)
+{
+	runJob([this, &f](int w) {
+		for (int i = w; i < models.size(); i += workers.size())
+			f(i, models[i]);
+	});
+}
+
+void Ensemble::forMember(int idx, const std::function<void(Model*)>& f)
+{
+	runJob([this, idx, &f](int w) {
+		if (getOwner(idx) == w)
+			f(models[idx]);
+	});
+}
+
+// While there are fewer members than places, the workers without a member
+// of their own help the big members of their NUMA node, so the tiles they
+// step stay in local memory. Returns whether any member is split.
+bool Ensemble::planTeams()
+{
+	int members = models.size();
+	parts.fill(1, members);
+	if (members >= places.size())
+		return false;
+	QVector<int> split;
+	for (int i = 0; i < members; i++)
+		if (models[i]->isSplittable())
+			split.append(i);
+	resizeWorkers(split.isEmpty() ? members : places.size());
+	if (split.isEmpty())
+		return false;
+
+	// with more workers than members, worker i owns member i
+	team.fill(-1, workers.size());
+	part.fill(0, workers.size());
+	for (int k = 0; k < split.size(); k++)
+		team[split[k]] = split[k];
+	for (int w = members; w < workers.size(); w++) {
+		int best = -1;
+		for (int k = 0; k < split.size(); k++) {
+			int i = split[k];
+			if (places[i].node != places[w].node || parts[i] >= models[i]->tileCount())
+				continue;
+			if (best < 0 || parts[i] < parts[best])
+				best = i;
+		}
+		if (best < 0)
+			continue;
+		team[w] = best;
+		part[w] = parts[best]++;
+	}
+	return true;
+}
+
+void Ensemble::step(int elapsed)
+{
+	if (planTeams()) {
+		runJob([this](int w) {
+			if (w < models.size() && parts[w] > 1)
+				models[w]->prepareStep(parts[w]);
+		});
+		runJob([this, elapsed](int w) {
+			if (w < models.size() && parts[w] == 1)
+				models[w]->step(elapsed);
+			else if (team[w] >= 0)
+				models[team[w]]->stepPart(elapsed, part[w], parts[team[w]]);
+		});
+		runJob([this, elapsed](int w) {
+			if (w < models.size() && parts[w] > 1)
+				models[w]->finishStep(elapsed);
+		});
+	} else {
+		forEach([elapsed](Model *model) {
+			model->step(elapsed);
+		});
+	}
+	if (models.isEmpty())
+		return;
+
+	// the members move in lockstep, so the first one's clock is everyone's
+	qreal timeFull = models[0]->timeFull;
+	if (scheduler.due(timeFull)) {
+		scheduler.taken(timeFull);
+		record(timeFull / 100.0);
+	}
+}
+
+// Every member records its sample into its worker's partial sums, which
+// are merged here; then the detectors are fed.
+void Ensemble::record(qreal t)
+{
+	QVector<RunningStats> partial(workers.size());
+	QVector<QuantileSketch> sketches(workers.size());
+	QVector<qint64> bytes(workers.size(), 0);
+	QVector<qreal> pressures(models.size());
+	QVector<qreal> intervals(models.size());
+	QVector<qreal> averages(models.size());
+	QVector<qreal> entropies(models.size());
+	QVector<qreal> entropySums(workers.size(), 0);
+	QVector<qreal> isotropySums(workers.size(), 0);
+	QVector<Histogram> directionPartials(workers.size(), Histogram(0, 2 * M_PI, angleBins));
+	int cells = binMeans.size();
+	QVector<QVector<qreal> > occupancy(workers.size(), QVector<qreal>(cells, 0));
+	bool windowed = scheduler.getRate() == MeasurementScheduler::Windowed;
+	runJob([this, t, windowed, cells, &partial, &sketches, &bytes, &pressures, &intervals, &averages,
+			&entropies, &entropySums, &isotropySums, &directionPartials, &occupancy](int w) {
+		for (int i = w; i < models.size(); i += workers.size()) {
+			qreal pressure = models[i]->record(t, windowed);
+			pressures[i] = pressure;
+			intervals[i] = models[i]->intervalPressure();
+			// the running time average, even when the one shown slides
+			averages[i] = models[i]->cumulativeAverage();
+			entropies[i] = models[i]->entropy();
+			entropySums[w] += entropies[i];
+			if (angleBins > 0) {
+				isotropySums[w] += models[i]->isotropy();
+				const QVector<int>& counts = models[i]->directions();
+				for (int a = 0; a < counts.size(); a++)
+					directionPartials[w].add(directionPartials[w].center(a), counts[a]);
+			}
+			partial[w].add(pressure);
+			sketches[w].add(pressure);
+			bytes[w] += models[i]->historyBytes();
+			int num = models[i]->getNumber();
+			if (cells > 0 && num > 0) {
+				const QVector<int>& counts = models[i]->occupancy();
+				for (int b = 0; b < cells; b++)
+					occupancy[w][b] += qreal(counts[b]) / num;
+			}
+		}
+	});
+
+	RunningStats total;
+	QuantileSketch sketch;
+	for (int w = 0; w < partial.size(); w++) {
+		total.merge(partial[w]);
+		sketch.merge(sketches[w]);
+	}
+	for (int b = 0; b < cells; b++) {
+		qreal sum = 0;
+		for (int w = 0; w < occupancy.size(); w++)
+			sum += occupancy[w][b];
+		binMeans[b].append(sum / models.size());
+		binMeanLevels[b].add(sum / models.size());
+	}
+	qreal entropy = 0;
+	for (int w = 0; w < entropySums.size(); w++)
+		entropy += entropySums[w];
+	entropy /= models.size();
+	if (isBinned()) {
+		entropyMeans.append(entropy);
+		entropyMeanLevels.add(entropy);
+	}
+	if (angleBins > 0) {
+		qreal isotropy = 0;
+		for (int w = 0; w < workers.size(); w++) {
+			isotropy += isotropySums[w];
+			directions.merge(directionPartials[w]);
+		}
+		isotropyMeans.append(isotropy / models.size());
+		isotropyMeanLevels.add(isotropy / models.size());
+	}
+	Quantiles q = sketch.quantiles();
+
+	QVector<int> reached(workers.size(), 0);
+	qreal mean = total.mean();
+	// the threshold compares the recorded pressure with the ensemble
+	// average; the statistical methods need the pressure of each interval,
+	// as the cumulative one drifts by construction
+	bool byEntropy = signal == Entropy && isBinned();
+	runJob([this, t, byEntropy, entropy, mean, &pressures, &intervals, &entropies, &reached](int w) {
+		for (int i = w; i < models.size(); i += workers.size()) {
+			EquilibriumDetector& detector = models[i]->detector;
+			qreal value = byEntropy ? entropies[i]
+				: detector.getMethod() == EquilibriumDetector::Threshold ? pressures[i] : intervals[i];
+			if (detector.add(t, value, byEntropy ? entropy : mean))
+				reached[w]++;
+		}
+	});
+	equilibrated = 0;
+	for (int w = 0; w < reached.size(); w++)
+		equilibrated += reached[w];
+	Divergence d = measureDivergence(averages, mean);
+
+	time.append(t);
+	stats.append(total);
+	quantiles.append(q);
+	timeLevels.add(t);
+	meanLevels.add(total.mean());
+	for (int k = 0; k < Quantiles::Count; k++)
+		quantileLevels[k].add(q.value[k]);
+	divergence.append(d);
+	for (int k = 0; k < Divergence::Count; k++)
+		divergenceLevels[k].add(d.value[k]);
+	taken++;
+
+	historyBytes = time.bytes() + stats.bytes() + quantiles.bytes() + divergence.bytes()
+		+ timeLevels.bytes() + meanLevels.bytes();
+	for (int k = 0; k < Quantiles::Count; k++)
+		historyBytes += quantileLevels[k].bytes();
+	for (int k = 0; k < Divergence::Count; k++)
+		historyBytes += divergenceLevels[k].bytes();
+	for (int b = 0; b < cells; b++)
+		historyBytes += binMeans[b].bytes() + binMeanLevels[b].bytes();
+	historyBytes += entropyMeans.bytes() + entropyMeanLevels.bytes()
+		+ isotropyMeans.bytes() + isotropyMeanLevels.bytes();
+	for (int w = 0; w < bytes.size(); w++)
+		historyBytes += bytes[w];
+	if (historyBytes > historyBudget && historyCapacity > 2 * CompressedHistory::BLOCK)
+		shrinkHistories();
+}
+
+// The time averages sit side by side, so the distances of all the members
+// are taken in one pass the compiler can vectorise.
+Divergence Ensemble::measureDivergence(const QVector<qreal>& averages, qreal mean) const
+{
+	const qreal *a = averages.constData();
+	int n = averages.size();
+	qreal scale = mean != 0 ? 1 / qAbs(mean) : 0;
+	qreal tolerance = ergodicityTolerance;
+	qreal sum = 0, worst = 0, within = 0;
+	for (int i = 0; i < n; i++) {
+		qreal distance = qAbs(a[i] - mean) * scale;
+		sum += distance;
+		worst = qMax(worst, distance);
+		within += distance <= tolerance ? 1 : 0;
+	}
+	Divergence d;
+	d.value[Divergence::Mean] = n > 0 ? sum / n : 0;
+	d.value[Divergence::Worst] = worst;
+	d.value[Divergence::Within] = n > 0 ? within / n : 0;
+	return d;
+}
+
+// Halves the full-resolution part of every history, in whole blocks.
+void Ensemble::shrinkHistories()
+{
+	historyCapacity = historyCapacity / 2 / CompressedHistory::BLOCK * CompressedHistory::BLOCK;
+	int samples = historyCapacity;
+	forEach([samples](Model *model) {
+		model->shrinkHistory(samples);
+	});
+	time.shrink(samples);
+	stats.shrink(samples);
+	timeLevels.shrink(samples);
+	meanLevels.shrink(samples);
+	quantiles.shrink(samples);
+	for (int k = 0; k < Quantiles::Count; k++)
+		quantileLevels[k].shrink(samples);
+	divergence.shrink(samples);
+	for (int k = 0; k < Divergence::Count; k++)
+		divergenceLevels[k].shrink(samples);
+	entropyMeans.shrink(samples);
+	entropyMeanLevels.shrink(samples);
+	isotropyMeans.shrink(samples);
+	isotropyMeanLevels.shrink(samples);
+	for (int b = 0; b < binMeans.size(); b++) {
+		binMeans[b].shrink(samples);
+		binMeanLevels[b].shrink(samples);
+	}
+}
+
+void Ensemble::setHistoryBudget(qint64 bytes)
+{
+	historyBudget = bytes;
+}
+
+int Ensemble::unmappedHistories() const
+{
+	if (historyPrefix.isEmpty())
+		return 0;
+	const CompressedHistory *histories[] = { &time, &entropyMeans, &isotropyMeans };
+	int count = 0;
+	for (int k = 0; k < 3; k++)
+		count += histories[k]->isMapped() ? 0 : 1;
+	count += (stats.isMapped() ? 0 : 1) + (quantiles.isMapped() ? 0 : 1) + (divergence.isMapped() ? 0 : 1);
+	for (int b = 0; b < binMeans.size(); b++)
+		count += binMeans[b].isMapped() ? 0 : 1;
+	for (int i = 0; i < models.size(); i++)
+		count += models[i]->unmappedHistories();
+	return count;
+}
+
+QString Ensemble::describeHistory() const
+{
+	QString text = QString("history %1 of %2 MiB, last %3 samples at full resolution, sampled every %4")
+			.arg(qulonglong(historyBytes >> 20))
+			.arg(qulonglong(historyBudget >> 20))
+			.arg(qMin(historyCapacity, time.size()))
+			.arg(scheduler.getInterval());
+	int unmapped = unmappedHistories();
+	if (unmapped > 0)
+		text += QString(", %1 histories in RAM instead of files").arg(unmapped);
+	return text;
+}
+
+void Ensemble::setTimeAverage(const TimeAverage& prototype)
+{
+	forEach([&prototype](Model *model) {
+		model->average = prototype;
+	});
+	clear();
+}
+
+void Ensemble::setEquilibrium(const EquilibriumDetector& prototype)
+{
+	forEach([&prototype](Model *model) {
+		model->detector = prototype;
+		model->detector.clear();
+	});
+	equilibrated = 0;
+}
+
+// The pressure spreads in proportion to the number of electrons, the
+// entropy over a fraction of its range ln(cells).
+EquilibriumDetector Ensemble::defaultDetector(int electrons) const
+{
+	qreal threshold = 0.03 * electrons;
+	if (signal == Entropy && isBinned())
+		threshold = 0.02 * log(qreal(qMax(1, binsNumber * binsNumber) * qMax(1, angleBins)));
+	EquilibriumDetector detector(20, threshold);
+	detector.setMethod(EquilibriumDetector::defaultMethod());
+	return detector;
+}
+
+void Ensemble::setEquilibriumSignal(Signal s)
+{
+	signal = s;
+	forEach([](Model *model) {
+		model->detector.clear();
+	});
+	equilibrated = 0;
+}
+
+QString Ensemble::signalName(Signal s)
+{
+	return s == Entropy ? "entropy" : "pressure";
+}
+
+bool Ensemble::signalFromName(const QString& name, Signal *s)
+{
+	for (int i = Pressure; i <= Entropy; i++)
+		if (name == signalName(Signal(i))) {
+			*s = Signal(i);
+			return true;
+		}
+	return false;
+}
+
+void Ensemble::setErgodicityTolerance(qreal fraction)
+{
+	ergodicityTolerance = fraction;
+}
+
+QString Ensemble::describeErgodicity() const
+{
+	if (divergence.isEmpty())
+		return QString();
+	Divergence d = divergence.last();
+	return QString("time averages within %1% of the ensemble average: %2%, mean distance %3%, worst %4%")
+			.arg(ergodicityTolerance * 100)
+			.arg(d.value[Divergence::Within] * 100)
+			.arg(d.value[Divergence::Mean] * 100)
+			.arg(d.value[Divergence::Worst] * 100);
+}
+
+void Ensemble::setEquilibratedFraction(qreal fraction)
+{
+	equilibratedFraction = fraction;
+}
+
+bool Ensemble::isEquilibrated() const
+{
+	return !models.isEmpty() && equilibrated >= qCeil(equilibratedFraction * models.size());
+}
+
+QVector<qreal> Ensemble::equilibrationTimes()
+{
+	QVector<qreal> times(models.size());
+	forEachMember([&times](int i, Model *model) {
+		times[i] = model->detector.reached() ? model->detector.time() : -1;
+	});
+	return times;
+}
+
+Histogram Ensemble::equilibrationHistogram(int bins)
+{
+	QVector<qreal> times = equilibrationTimes();
+	QVector<qreal> reached;
+	for (int i = 0; i < times.size(); i++)
+		if (times[i] >= 0)
+			reached.append(times[i]);
+	return Histogram::of(reached, bins);
+}
+
+void Ensemble::setBinsNumber(int n)
+{
+	binsNumber = qMax(0, n);
+	forEach([n](Model *model) {
+		model->setBinsNumber(n);
+	});
+	int cells = binsNumber * binsNumber;
+	binMeans = QVector<CompressedHistory>(cells);
+	binMeanLevels = QVector<HistoryPyramid>(cells);
+	if (!historyPrefix.isEmpty())
+		for (int b = 0; b < cells; b++)
+			binMeans[b].mapTo(QString("%1-bin%2.hist").arg(historyPrefix).arg(b));
+	clear();
+}
+
+void Ensemble::setAngleBinsNumber(int n)
+{
+	angleBins = qMax(0, n);
+	forEach([n](Model *model) {
+		model->setAngleBinsNumber(n);
+	});
+	clear();
+}
+
+void Ensemble::setScheduler(const MeasurementScheduler& value)
+{
+	scheduler = value;
+	clear();
+}
+
+void Ensemble::saveState(QDataStream& out) const
+{
+	scheduler.saveState(out);
+}
+
+void Ensemble::loadState(QDataStream& in)
+{
+	scheduler.loadState(in);
+}
+
+void Ensemble::clear()
+{
+	// a new measurement starts with the full capacity again
+	historyCapacity = Model::MAX_HISTORY;
+	historyBytes = 0;
+	scheduler.clear();
+	time.setCapacity(historyCapacity);
+	stats.setCapacity(historyCapacity);
+	timeLevels.setCapacity(historyCapacity);
+	meanLevels.setCapacity(historyCapacity);
+	quantiles.setCapacity(historyCapacity);
+	for (int k = 0; k < Quantiles::Count; k++)
+		quantileLevels[k].setCapacity(historyCapacity);
+	divergence.setCapacity(historyCapacity);
+	for (int k = 0; k < Divergence::Count; k++)
+		divergenceLevels[k].setCapacity(historyCapacity);
+	entropyMeans.setCapacity(historyCapacity);
+	entropyMeanLevels.setCapacity(historyCapacity);
+	isotropyMeans.setCapacity(historyCapacity);
+	isotropyMeanLevels.setCapacity(historyCapacity);
+	directions = Histogram(0, 2 * M_PI, angleBins);
+	for (int b = 0; b < binMeans.size(); b++) {
+		binMeans[b].setCapacity(historyCapacity);
+		binMeanLevels[b].setCapacity(historyCapacity);
+	}
+	taken = 0;
+	equilibrated = 0;
+	forEach([](Model *model) {
+		model->clear();
+	});
+}
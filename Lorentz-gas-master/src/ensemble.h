@@ -0,0 +1,264 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <QVector>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <functional>
+
+#include "topology.h"
+#include "ringbuffer.h"
+#include "compressedhistory.h"
+#include "statistics.h"
+#include "averages.h"
+#include "sampling.h"
+#include "pyramid.h"
+#include "equilibrium.h"
+
+class Model;
+class Ensemble;
+
+// Thread which runs the ensemble jobs for the members it owns.
+class EnsembleWorker : public QThread
+{
+public:
+	EnsembleWorker(Ensemble *owner, int index, int node, int cpu, int generation);
+
+	int getNode() const { return node; }
+	int getCpu() const { return cpu.loadAcquire(); }
+
+protected:
+	void run();
+
+private:
+	Ensemble *owner;
+	int index;
+	int node;
+	QAtomicInt cpu;	// -1 once the thread failed to pin
+	int generation;
+};
+
+// The ensemble of models stepped in lockstep.
+// Member i is owned by worker i % getWorkerCount() for its whole life: the
+// worker allocates it (first touch puts its memory on the worker's NUMA node)
+// and is the only thread that steps or reconfigures it. Workers are spread
+// over the NUMA nodes and, when pinning is on, bound to a CPU each. Growing
+// the ensemble starts the next workers in line, which leaves every existing
+// member with its owner. Workers beyond the members run only while some
+// member is big enough to be split (Model::isSplittable()); they then step
+// parts of the tiles of the big members on their own NUMA node.
+class Ensemble
+{
+public:
+	Ensemble();
+	~Ensemble();
+
+	// Places the workers on the given CPUs (all when empty), one worker per
+	// CPU at most. Only allowed while the ensemble is empty.
+	void configure(const QVector<int>& cpus, bool pin);
+
+	void setDim(int w, int h);
+	void setSize(int size);
+	// Member i places its particles with a generator seeded with seed + i,
+	// 1 by default; reseeds the members already there.
+	void setSeed(int value);
+	int size() const { return models.size(); }
+	Model* getModel(int idx) { return models[idx]; }
+
+	// Runs f on every member, on the member's own worker.
+	void forEach(const std::function<void(Model*)>& f);
+	void forEachMember(const std::function<void(int, Model*)>& f);
+	// Runs f on member idx only, on its worker.
+	void forMember(int idx, const std::function<void(Model*)>& f);
+	void step(int elapsed);
+	void clear();
+
+	// How the members average their pressure over time (clears the history).
+	void setTimeAverage(const TimeAverage& prototype);
+	// Keeps the histories in files dir/name-*.hist (clears the history);
+	// an empty dir keeps them in RAM for members added from now on.
+	// By default dir is historyDirectory().
+	void setHistoryDirectory(const QString& dir, const QString& name);
+
+	// Bytes of RAM all the histories together may take. Past it, the
+	// full-resolution part of every history is halved; the older samples
+	// stay on the coarse levels of the pyramids. By default the budget is
+	// LORENTZ_HISTORY_BUDGET MiB or a quarter of the physical memory.
+	void setHistoryBudget(qint64 bytes);
+	qint64 getHistoryBudget() const { return historyBudget; }
+	// RAM taken by the histories when the last sample was recorded.
+	qint64 getHistoryBytes() const { return historyBytes; }
+	// Samples kept at full resolution.
+	int getHistoryCapacity() const { return historyCapacity; }
+	// Histories of the ensemble and its members which stayed in RAM with
+	// a history directory set, as their files could not be mapped.
+	int unmappedHistories() const;
+	QString describeHistory() const;
+
+	// What the detectors look at: the pressure, or the coarse-grained
+	// entropy, far less noisy for few particles. The entropy needs the
+	// members binned; the pressure stands in for it otherwise.
+	enum Signal {
+		Pressure,
+		Entropy
+	};
+
+	// How every member detects its equilibrium, against the ensemble
+	// average (restarts the detection).
+	void setEquilibrium(const EquilibriumDetector& prototype);
+	// The detector the GUI and the headless runs use for members of the
+	// given number of electrons, on the current signal and bins, with
+	// EquilibriumDetector::defaultMethod().
+	EquilibriumDetector defaultDetector(int electrons) const;
+	// Restarts the detection as well; by default LORENTZ_EQUILIBRIUM_SIGNAL
+	// (pressure or entropy), the pressure when unset.
+	void setEquilibriumSignal(Signal s);
+	Signal getEquilibriumSignal() const { return signal; }
+	static QString signalName(Signal s);
+	// False when name is none of the signalName()s.
+	static bool signalFromName(const QString& name, Signal *s);
+	// The ensemble is in equilibrium once this fraction of the members is,
+	// by default LORENTZ_EQUILIBRATED when in (0, 1], otherwise 0.9.
+	void setEquilibratedFraction(qreal fraction);
+	qreal getEquilibratedFraction() const { return equilibratedFraction; }
+	// Members in equilibrium at the last sample.
+	int equilibratedCount() const { return equilibrated; }
+	bool isEquilibrated() const;
+	// Equilibration time of every member, -1 for those not there yet.
+	QVector<qreal> equilibrationTimes();
+	// Distribution of the equilibration times of the members there.
+	Histogram equilibrationHistogram(int bins);
+
+	// Members whose time average is within this fraction of the ensemble
+	// average count as ergodic; LORENTZ_ERGODICITY_TOLERANCE or 0.03.
+	void setErgodicityTolerance(qreal fraction);
+	qreal getErgodicityTolerance() const { return ergodicityTolerance; }
+	QString describeErgodicity() const;
+
+	// Splits the field of every member into n x n occupancy bins, none
+	// when 0 (clears the history).
+	void setBinsNumber(int n);
+	int getBinsNumber() const { return binsNumber; }
+	// Splits the directions into n bins as well, none when 0 (clears the
+	// history).
+	void setAngleBinsNumber(int n);
+	int getAngleBinsNumber() const { return angleBins; }
+	bool isBinned() const { return binsNumber > 0 || angleBins > 0; }
+	// Directions of all the members' particles at all the samples since the
+	// last clear(), over [0, 2 pi) in the direction bins.
+	const Histogram& directionHistogram() const { return directions; }
+
+	// When and what the ensemble samples (clears the history).
+	void setScheduler(const MeasurementScheduler& value);
+	const MeasurementScheduler& getScheduler() const { return scheduler; }
+	// What a run resumed from the members' saved states needs besides
+	// them: when the next sample is due.
+	void saveState(QDataStream& out) const;
+	void loadState(QDataStream& in);
+
+	// Sample times shared by all members: sample j of every member's
+	// pressure history was taken at time[j].
+	CompressedView timeView() const { return time.view(); }
+	// Pressure across the members at each sample time, accumulated while
+	// the members record the sample.
+	HistoryView<RunningStats> statsView() const { return stats.view(); }
+	// Quantiles of the pressure across the members at each sample time,
+	// sketched in parallel while the members record the sample.
+	HistoryView<Quantiles> quantilesView() const { return quantiles.view(); }
+	// Distance of the members' time averages from the ensemble average at
+	// each sample time.
+	HistoryView<Divergence> divergenceView() const { return divergence.view(); }
+	// Fraction of the particles in the bin averaged over the members at
+	// each sample time.
+	CompressedView binMeanView(int bin) const { return binMeans[bin].view(); }
+	// Coarse-grained entropy averaged over the members at each sample
+	// time, while binned.
+	CompressedView entropyMeanView() const { return entropyMeans.view(); }
+	// Chi-square of the directions against isotropy averaged over the
+	// members at each sample time, while the directions are binned.
+	CompressedView isotropyMeanView() const { return isotropyMeans.view(); }
+	// Coarse levels of the sample times and of the ensemble-averaged pressure.
+	const HistoryPyramid& getTimeLevels() const { return timeLevels; }
+	const HistoryPyramid& getMeanLevels() const { return meanLevels; }
+	const HistoryPyramid& getQuantileLevels(int i) const { return quantileLevels[i]; }
+	const HistoryPyramid& getDivergenceLevels(int i) const { return divergenceLevels[i]; }
+	const HistoryPyramid& getBinMeanLevels(int bin) const { return binMeanLevels[bin]; }
+	const HistoryPyramid& getEntropyMeanLevels() const { return entropyMeanLevels; }
+	const HistoryPyramid& getIsotropyMeanLevels() const { return isotropyMeanLevels; }
+	// Samples taken since the last clear(), including overwritten ones.
+	qint64 samplesTaken() const { return taken; }
+
+	int getWorkerCount() const { return workers.size(); }
+	int getOwner(int idx) const { return idx % workers.size(); }
+	const QVector<NumaNode>& getTopology() const { return topology; }
+
+private:
+	friend class EnsembleWorker;
+
+	void runJob(const std::function<void(int)>& f);
+	void record(qreal t);
+	Divergence measureDivergence(const QVector<qreal>& averages, qreal mean) const;
+	void mapHistories(int from);
+	void shrinkHistories();
+	void workerLoop(int index, int seen);
+	void resizeWorkers(int count);
+	bool planTeams();
+
+	QVector<Model*> models;
+	CompressedHistory time;
+	RingBuffer<RunningStats> stats;
+	HistoryPyramid timeLevels;
+	HistoryPyramid meanLevels;
+	RingBuffer<Quantiles> quantiles;
+	HistoryPyramid quantileLevels[Quantiles::Count];
+	RingBuffer<Divergence> divergence;
+	HistoryPyramid divergenceLevels[Divergence::Count];
+	qreal ergodicityTolerance;
+	int binsNumber;
+	int angleBins;
+	QVector<CompressedHistory> binMeans;
+	QVector<HistoryPyramid> binMeanLevels;
+	CompressedHistory entropyMeans;
+	HistoryPyramid entropyMeanLevels;
+	CompressedHistory isotropyMeans;
+	HistoryPyramid isotropyMeanLevels;
+	Histogram directions;
+	Signal signal;
+	int seed;
+	qint64 taken;
+	int equilibrated;
+	qreal equilibratedFraction;
+	MeasurementScheduler scheduler;
+	QVector<EnsembleWorker*> workers;
+	// where the workers go, in order; the first workers.size() are running
+	struct Place
+	{
+		int node;
+		int cpu;	// -1 when not pinned
+	};
+	QVector<Place> places;
+	// member whose tiles each worker steps while members are split, -1 for
+	// none, and which part of them; parts of every member, 1 when whole
+	QVector<int> team;
+	QVector<int> part;
+	QVector<int> parts;
+	QVector<NumaNode> topology;
+	int width;
+	int height;
+	QString historyPrefix;	// empty when the histories are in RAM
+	qint64 historyBudget;
+	qint64 historyBytes;
+	int historyCapacity;
+
+	QMutex mutex;
+	QWaitCondition jobReady;
+	QWaitCondition jobDone;
+	const std::function<void(int)> *job;
+	int generation;
+	int pending;
+	int active;	// workers with a higher index quit
+};
+
+#endif
@@ -0,0 +1,321 @@
+#include <QtGlobal>
+#include <QtMath>
+#include "equilibrium.h"
+
+// Standard normal quantile (Acklam's approximation).
+static qreal normalQuantile(qreal p)
+{
+	static const qreal a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+		1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+	static const qreal b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+		6.680131188771972e+01, -1.328068155288572e+01 };
+	static const qreal c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+		-2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+	static const qreal d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+		3.754408661907416e+00 };
+	const qreal low = 0.02425;
+
+	if (p <= 0)
+		return -1e300;
+	if (p >= 1)
+		return 1e300;
+	if (p < low) {
+		qreal q = qSqrt(-2 * qLn(p));
+		return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+			((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+	}
+	if (p > 1 - low)
+		return -normalQuantile(1 - p);
+	qreal q = p - 0.5;
+	qreal r = q * q;
+	return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+		(((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+EquilibriumDetector::EquilibriumDetector(int window, qreal threshold)
+	: method(Threshold), window(qMax(1, window)), threshold(threshold), precision(0.01)
+{
+	setConfidence(0.95);
+	clear();
+}
+
+void EquilibriumDetector::setMethod(Method m)
+{
+	method = m;
+	clear();
+}
+
+void EquilibriumDetector::setWindow(int samples)
+{
+	window = qMax(1, samples);
+	clear();
+}
+
+void EquilibriumDetector::setThreshold(qreal value)
+{
+	threshold = value;
+}
+
+void EquilibriumDetector::setConfidence(qreal value)
+{
+	level = qBound<qreal>(0.5, value, 0.999999);
+	z = normalQuantile((1 + level) / 2);
+}
+
+void EquilibriumDetector::setPrecision(qreal relative)
+{
+	precision = relative;
+}
+
+void EquilibriumDetector::clear()
+{
+	deviations.clear();
+	times.clear();
+	next = 0;
+	sum = 0;
+
+	batches.clear();
+	open.sum = 0;
+	open.count = 0;
+	open.start = 0;
+	batchLength = 1;
+
+	found = false;
+	foundTime = -1;
+}
+
+void EquilibriumDetector::saveState(QDataStream& out) const
+{
+	out << int(method) << window << threshold << level << precision << z;
+	out << deviations << times << next << sum;
+	out << batches.size();
+	for (int i = 0; i < batches.size(); i++)
+		out << batches[i].sum << batches[i].count << batches[i].start;
+	out << open.sum << open.count << open.start << batchLength;
+	out << found << foundTime;
+}
+
+void EquilibriumDetector::loadState(QDataStream& in)
+{
+	int m, count;
+	in >> m >> window >> threshold >> level >> precision >> z;
+	method = Method(m);
+	in >> deviations >> times >> next >> sum;
+	in >> count;
+	batches.resize(count);
+	for (int i = 0; i < count; i++)
+		in >> batches[i].sum >> batches[i].count >> batches[i].start;
+	in >> open.sum >> open.count >> open.start >> batchLength;
+	in >> found >> foundTime;
+}
+
+qreal EquilibriumDetector::deviation() const
+{
+	return deviations.isEmpty() ? 0 : sum / deviations.size();
+}
+
+QString EquilibriumDetector::methodName(Method m)
+{
+	switch (m) {
+	case Threshold:
+		return "threshold";
+	case BatchMeans:
+		return "batch-means";
+	case Geweke:
+		return "geweke";
+	case MSER:
+		return "mser";
+	}
+	return QString();
+}
+
+bool EquilibriumDetector::methodFromName(const QString& name, Method *m)
+{
+	for (int i = Threshold; i <= MSER; i++)
+		if (name == methodName(Method(i))) {
+			*m = Method(i);
+			return true;
+		}
+	return false;
+}
+
+EquilibriumDetector::Method EquilibriumDetector::defaultMethod()
+{
+	Method m;
+	if (methodFromName(QString::fromLocal8Bit(qgetenv("LORENTZ_EQUILIBRIUM")), &m))
+		return m;
+	return Geweke;
+}
+
+bool EquilibriumDetector::add(qreal t, qreal value, qreal reference)
+{
+	if (method == Threshold)
+		return addThreshold(t, value, reference);
+	if (found)
+		return true;
+
+	int completed = batches.size();
+	addBatched(t, value);
+	int start;
+	// only a new batch can change the outcome
+	if (batches.size() != completed && test(&start)) {
+		found = true;
+		foundTime = batches[start].start;
+	}
+	return found;
+}
+
+bool EquilibriumDetector::addThreshold(qreal t, qreal value, qreal reference)
+{
+	qreal d = qAbs(value - reference);
+	if (deviations.size() < window) {
+		deviations.append(d);
+		times.append(t);
+		sum += d;
+	}
+	else {
+		sum += d - deviations[next];
+		deviations[next] = d;
+		times[next] = t;
+		next = (next + 1) % window;
+		// resum once per window to keep rounding errors from piling up
+		if (next == 0) {
+			sum = 0;
+			for (int i = 0; i < window; i++)
+				sum += deviations[i];
+		}
+	}
+
+	// like the original criterion, a full window is required
+	if (!found && deviations.size() == window && sum / window < threshold) {
+		found = true;
+		foundTime = times[next];	// the oldest sample of the window
+	}
+	return found;
+}
+
+void EquilibriumDetector::addBatched(qreal t, qreal value)
+{
+	if (open.count == 0)
+		open.start = t;
+	open.sum += value;
+	open.count++;
+	if (open.count < batchLength)
+		return;
+
+	batches.append(open);
+	open.sum = 0;
+	open.count = 0;
+	if (batches.size() == MAX_BATCHES) {
+		// pairs of batches make the batches of twice the length
+		for (int i = 0; i < MAX_BATCHES / 2; i++) {
+			Batch merged = batches[2 * i];
+			merged.sum += batches[2 * i + 1].sum;
+			merged.count += batches[2 * i + 1].count;
+			batches[i] = merged;
+		}
+		batches.resize(MAX_BATCHES / 2);
+		batchLength *= 2;
+	}
+}
+
+QVector<qreal> EquilibriumDetector::batchMeans() const
+{
+	QVector<qreal> means(batches.size());
+	for (int i = 0; i < batches.size(); i++)
+		means[i] = batchMean(i);
+	return means;
+}
+
+// Mean and variance of the batch means in [from, to).
+static void batchStats(const QVector<qreal>& means, int from, int to, qreal *mean, qreal *variance)
+{
+	int n = to - from;
+	qreal s = 0;
+	for (int i = from; i < to; i++)
+		s += means[i];
+	*mean = s / n;
+	qreal s2 = 0;
+	for (int i = from; i < to; i++)
+		s2 += (means[i] - *mean) * (means[i] - *mean);
+	*variance = n > 1 ? s2 / (n - 1) : 0;
+}
+
+// Whether the means of [a0, a1) and [b0, b1) agree within z standard errors.
+static bool segmentsAgree(const QVector<qreal>& means, int a0, int a1, int b0, int b1, qreal z)
+{
+	qreal ma, va, mb, vb;
+	batchStats(means, a0, a1, &ma, &va);
+	batchStats(means, b0, b1, &mb, &vb);
+	qreal se = qSqrt(va / (a1 - a0) + vb / (b1 - b0));
+	return qAbs(ma - mb) <= z * se;
+}
+
+bool EquilibriumDetector::halvesAgree(int from) const
+{
+	QVector<qreal> means = batchMeans();
+	int half = from + (batches.size() - from) / 2;
+	return segmentsAgree(means, from, half, half, batches.size(), z);
+}
+
+bool EquilibriumDetector::gewekeAgrees(int from) const
+{
+	QVector<qreal> means = batchMeans();
+	int rest = batches.size() - from;
+	int first = qMax(2, rest / 10);
+	return segmentsAgree(means, from, from + first, batches.size() - rest / 2, batches.size(), z);
+}
+
+// Short runs pass any test, so the mean must be known to the precision.
+bool EquilibriumDetector::precise(int from) const
+{
+	QVector<qreal> means = batchMeans();
+	qreal mean, variance;
+	batchStats(means, from, batches.size(), &mean, &variance);
+	return z * qSqrt(variance / (batches.size() - from)) <= precision * qAbs(mean);
+}
+
+// The start minimising the variance of the mean of the rest.
+int EquilibriumDetector::mserStart() const
+{
+	int n = batches.size();
+	qreal s1 = 0, s2 = 0;
+	qreal best = -1;
+	int start = 0;
+	for (int d = n - 1; d >= 0; d--) {
+		qreal m = batchMean(d);
+		s1 += m;
+		s2 += m * m;
+		int k = n - d;
+		if (k < 2)
+			continue;
+		qreal mser = (s2 - s1 * s1 / k) / (qreal(k) * k);
+		if (best < 0 || mser <= best) {
+			best = mser;
+			start = d;
+		}
+	}
+	return start;
+}
+
+bool EquilibriumDetector::test(int *start) const
+{
+	int n = batches.size();
+	if (n < MIN_BATCHES)
+		return false;
+
+	if (method == MSER) {
+		*start = mserStart();
+		return *start <= n / 2 && halvesAgree(*start) && precise(*start);
+	}
+
+	// the starts tried: every eighth of the history up to the half
+	for (int d = 0; d <= n / 2; d += n / 8) {
+		bool agree = method == Geweke ? gewekeAgrees(d) : halvesAgree(d);
+		if (agree && precise(d)) {
+			*start = d;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,108 @@
+#ifndef EQUILIBRIUM_H
+#define EQUILIBRIUM_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <QDataStream>
+
+// Decides when a member's signal has reached equilibrium:
+//   Threshold  - mean |value - reference| over the last window samples
+//                below the threshold
+//   BatchMeans - the halves after the start agree within their batch-means
+//                confidence interval
+//   Geweke     - the first 10% and the last 50% after the start agree
+//   MSER       - as BatchMeans, from the start of least standard error
+// The statistical methods keep at most MAX_BATCHES batch means and also
+// need the mean after the start to setPrecision().
+class EquilibriumDetector
+{
+public:
+	enum Method {
+		Threshold,
+		BatchMeans,
+		Geweke,
+		MSER
+	};
+
+	enum { MIN_BATCHES = 64, MAX_BATCHES = 128 };
+
+	EquilibriumDetector(int window = 20, qreal threshold = 0);
+
+	void setMethod(Method m);
+	Method getMethod() const { return method; }
+	void setWindow(int samples);
+	void setThreshold(qreal value);
+	// Confidence level of the statistical tests, 0.95 by default.
+	void setConfidence(qreal level);
+	// Largest half-width of the confidence interval of the mean after the
+	// start, relative to the mean; 0.01 by default.
+	void setPrecision(qreal relative);
+	int getWindow() const { return window; }
+	qreal getThreshold() const { return threshold; }
+
+	void clear();
+
+	// The whole state, for checkpoints.
+	void saveState(QDataStream& out) const;
+	void loadState(QDataStream& in);
+
+	// Feeds the sample taken at time t; returns true once equilibrium
+	// has been reached (at this or an earlier sample).
+	bool add(qreal t, qreal value, qreal reference);
+
+	bool reached() const { return found; }
+	// Time from which the samples are in equilibrium.
+	qreal time() const { return foundTime; }
+	// Level of the single test which found it, not of the repeated
+	// testing; 0 for Threshold.
+	qreal confidence() const { return found && method != Threshold ? level : 0; }
+	// Current mean deviation over the window (Threshold only).
+	qreal deviation() const;
+
+	static QString methodName(Method m);
+	// False when name is none of the methodName()s.
+	static bool methodFromName(const QString& name, Method *m);
+	// The method named by LORENTZ_EQUILIBRIUM (threshold, batch-means,
+	// geweke or mser), Geweke when unset or unknown.
+	static Method defaultMethod();
+
+private:
+	struct Batch
+	{
+		qreal sum;
+		int count;
+		qreal start;	// time of the first sample
+	};
+
+	bool addThreshold(qreal t, qreal value, qreal reference);
+	void addBatched(qreal t, qreal value);
+	bool test(int *start) const;
+	bool halvesAgree(int from) const;
+	bool gewekeAgrees(int from) const;
+	bool precise(int from) const;
+	int mserStart() const;
+	qreal batchMean(int i) const { return batches[i].sum / batches[i].count; }
+	QVector<qreal> batchMeans() const;
+
+	Method method;
+	int window;
+	qreal threshold;
+	qreal level;
+	qreal precision;
+	qreal z;		// two-sided normal quantile of level
+
+	QVector<qreal> deviations;	// circular, the last window samples
+	QVector<qreal> times;
+	int next;
+	qreal sum;
+
+	QVector<Batch> batches;		// complete batches, oldest first
+	Batch open;
+	int batchLength;
+
+	bool found;
+	qreal foundTime;
+};
+
+#endif
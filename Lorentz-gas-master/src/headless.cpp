@@ -0,0 +1,896 @@
+#include <QDir>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QFile>
+#include <QDataStream>
+#include <QTextStream>
+#include <QCoreApplication>
+#include "headless.h"
+#include "ensemble.h"
+#include "hugepages.h"
+#include "model.h"
+#include "statistics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+#include <functional>
+#include <new>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef LORENTZ_MPI
+#include <mpi.h>
+#endif
+
+static const int EQUILIBRATION_BINS = 20;
+
+// Free flights of a slice: the histogram bins of all its members, then
+// their flight count, flight sum and collision frequency sum.
+static int flightSlots()
+{
+	return Model::FLIGHT_BINS + 3;
+}
+
+HeadlessOptions::HeadlessOptions()
+{
+	// the defaults of the GUI
+	members = 10;
+	electrons = 100;
+	side = 50;
+	atomR = 10;
+	electronR = 4;
+	speed = 100;
+	width = 400;
+	height = 400;
+
+	steps = 2000;
+	dt = 50;
+	every = 1;
+	seed = 1;
+	bins = 0;
+	angleBins = 0;
+
+	processes = 1;
+	checkpoint = 0;
+	retries = 3;
+	reduce = 100;
+	historyBudget = 0;
+
+	equilibrium = EquilibriumDetector::methodName(EquilibriumDetector::defaultMethod());
+	signal = "pressure";
+	rate = MeasurementScheduler::rateName(MeasurementScheduler::defaultRate());
+	equilibrated = 0;
+
+	output = "-";
+	scratch = QDir::tempPath();
+	runId = 0;
+}
+
+bool HeadlessOptions::parse(const QStringList& args, QString *error)
+{
+	for (int i = 1; i < args.size(); i++) {
+		QString name = args[i];
+		if (name == "--headless")
+			continue;
+		if (i + 1 >= args.size()) {
+			*error = QString("missing value for %1").arg(name);
+			return false;
+		}
+		QString value = args[++i];
+		bool ok = true;
+		if (name == "--members")
+			members = value.toInt(&ok);
+		else if (name == "--electrons")
+			electrons = value.toInt(&ok);
+		else if (name == "--side")
+			side = value.toInt(&ok);
+		else if (name == "--atom-r")
+			atomR = value.toDouble(&ok);
+		else if (name == "--electron-r")
+			electronR = value.toDouble(&ok);
+		else if (name == "--speed")
+			speed = value.toDouble(&ok);
+		else if (name == "--width")
+			width = value.toInt(&ok);
+		else if (name == "--height")
+			height = value.toInt(&ok);
+		else if (name == "--steps")
+			steps = value.toInt(&ok);
+		else if (name == "--dt")
+			dt = value.toInt(&ok);
+		else if (name == "--every")
+			every = value.toInt(&ok);
+		else if (name == "--seed")
+			seed = value.toInt(&ok);
+		else if (name == "--bins") {
+			bins = value.toInt(&ok);
+			ok = ok && bins >= 0;
+		}
+		else if (name == "--angle-bins") {
+			angleBins = value.toInt(&ok);
+			ok = ok && angleBins >= 0;
+		}
+		else if (name == "--processes")
+			processes = value.toInt(&ok);
+		else if (name == "--checkpoint")
+			checkpoint = value.toInt(&ok);
+		else if (name == "--retries")
+			retries = value.toInt(&ok);
+		else if (name == "--reduce")
+			reduce = value.toInt(&ok);
+		else if (name == "--output")
+			output = value;
+		else if (name == "--scratch")
+			scratch = value;
+		else if (name == "--run-id")
+			runId = value.toLongLong(&ok);
+		else if (name == "--history")
+			history = value;
+		else if (name == "--history-budget")
+			historyBudget = value.toInt(&ok);
+		else if (name == "--equilibrium") {
+			EquilibriumDetector::Method m;
+			ok = EquilibriumDetector::methodFromName(value, &m);
+			equilibrium = value;
+		}
+		else if (name == "--signal") {
+			Ensemble::Signal s;
+			ok = Ensemble::signalFromName(value, &s);
+			signal = value;
+		}
+		else if (name == "--rate") {
+			MeasurementScheduler::Rate r;
+			ok = MeasurementScheduler::rateFromName(value, &r);
+			rate = value;
+		}
+		else if (name == "--equilibrated") {
+			equilibrated = value.toDouble(&ok);
+			ok = ok && equilibrated >= 0 && equilibrated <= 1;
+		}
+		else if (name == "--equilibration")
+			equilibration = value;
+		else if (name == "--flights")
+			flights = value;
+		else {
+			*error = QString("unknown option %1").arg(name);
+			return false;
+		}
+		if (!ok) {
+			*error = QString("bad value %1 for %2").arg(value).arg(name);
+			return false;
+		}
+	}
+	if (members < 1 || steps < 1 || dt < 1 || every < 1 || processes < 1 || reduce < 1) {
+		*error = "members, steps, dt, every, processes and reduce must be positive";
+		return false;
+	}
+	processes = qMin(processes, members);
+	return true;
+}
+
+// A slice of the ensemble simulated by one worker process.
+class Shard
+{
+public:
+	// Slice index of count; cpuShare of cpuShares is the part of the local
+	// machine's CPUs the shard may use.
+	Shard(const HeadlessOptions& options, int index, int count, int cpuShare, int cpuShares);
+
+	// Stores the sums over the slice of sample k in sums[k * o.columns()]
+	// onwards, as the columns of the output, the number of samples
+	// stored in *stored and at the end the equilibration time of member i
+	// of the whole ensemble in equilibration[i] and the flightSlots() of
+	// the slice in flights.
+	int run(double *sums, double *equilibration, double *flights, int *stored);
+	int equilibrated() const { return ensemble.equilibratedCount(); }
+
+	// Called with the number of samples stored so far; returns true to stop
+	// the run there. By default the run stops once the slice is in
+	// equilibrium, when o.equilibrated is set.
+	std::function<bool(int)> onSample;
+	// Returns the lowest of the values all the shards pass. Set when the
+	// shards must resume from the same step: each keeps its last two
+	// checkpoints, and all of them step back to the newest one none of
+	// them is past, or start over.
+	std::function<int(int)> lowest;
+	// Samples stored before the run resumed from a checkpoint.
+	int resumedSamples() const { return resumed; }
+
+private:
+	void setUp();
+	QVector<int> checkpointSteps();
+	int agreeCheckpoint();
+	int loadCheckpoint(int done);
+	void saveCheckpoint(int done);
+	void sampleSums(double *row);
+
+	const HeadlessOptions& o;
+	int index;
+	int count;
+	int cpuShare;
+	int cpuShares;
+	int first;
+	int last;
+	int resumed;
+	QString checkpointFile;
+	Ensemble ensemble;
+};
+
+// pid of the coordinator, so that a restarted shard finds its checkpoint
+static qint64 runId = 0;
+
+static QString checkpointName(const HeadlessOptions& o, int index)
+{
+	return QDir(o.scratch).filePath(QString("lorentz-%1-shard%2.ckpt").arg(runId).arg(index));
+}
+
+Shard::Shard(const HeadlessOptions& options, int index, int count, int cpuShare, int cpuShares)
+	: o(options), index(index), count(count), cpuShare(cpuShare), cpuShares(cpuShares)
+{
+	resumed = 0;
+	first = qlonglong(o.members) * index / count;
+	last = qlonglong(o.members) * (index + 1) / count;
+	checkpointFile = checkpointName(o, index);
+}
+
+void Shard::setUp()
+{
+	// processes share the machine: every shard takes its own share of CPUs
+	QVector<int> cpus;
+	QVector<NumaNode> nodes = detectTopology();
+	int k = 0;
+	for (int n = 0; n < nodes.size(); n++)
+		for (int c = 0; c < nodes[n].cpus.size(); c++, k++)
+			if (k % cpuShares == cpuShare)
+				cpus.append(nodes[n].cpus[c]);
+	ensemble.configure(cpus, cpuShares > 1);
+
+	// member i of the whole ensemble is seeded with seed + i
+	ensemble.setSeed(o.seed + first);
+	if (!o.history.isEmpty())
+		ensemble.setHistoryDirectory(o.history, QString("lorentz-%1-shard%2").arg(runId).arg(index));
+	if (o.historyBudget > 0)
+		ensemble.setHistoryBudget((qint64(o.historyBudget) << 20) / count);
+	ensemble.setDim(o.width, o.height);
+	ensemble.setSize(last - first);
+	const HeadlessOptions& opt = o;
+	ensemble.forEach([&opt](Model *model) {
+		model->setSide(opt.side);
+		model->setAtomR(opt.atomR);
+		model->setElectronR(opt.electronR);
+		model->setSpeed(opt.speed);
+		model->setDim(opt.width, opt.height);
+		model->setNumber(opt.electrons);
+	});
+	if (o.bins > 0)
+		ensemble.setBinsNumber(o.bins);
+	if (o.angleBins > 0)
+		ensemble.setAngleBinsNumber(o.angleBins);
+	// every history file is a mapping of its own
+	int unmapped = ensemble.unmappedHistories();
+	if (unmapped > 0)
+		fprintf(stderr, "lorentz: shard %d: %d histories could not be mapped and stay in RAM "
+			"(vm.max_map_count too low?)\n", index, unmapped);
+
+	MeasurementScheduler scheduler = ensemble.getScheduler();
+	MeasurementScheduler::Rate rate;
+	if (MeasurementScheduler::rateFromName(o.rate, &rate))
+		scheduler.setRate(rate);
+	ensemble.setScheduler(scheduler);
+
+	Ensemble::Signal signal;
+	if (!Ensemble::signalFromName(o.signal, &signal))
+		signal = Ensemble::Pressure;
+	ensemble.setEquilibriumSignal(signal);
+	EquilibriumDetector detector = ensemble.defaultDetector(o.electrons);
+	EquilibriumDetector::Method method;
+	if (EquilibriumDetector::methodFromName(o.equilibrium, &method))
+		detector.setMethod(method);
+	ensemble.setEquilibrium(detector);
+	if (o.equilibrated > 0)
+		ensemble.setEquilibratedFraction(o.equilibrated);
+}
+
+// Steps done according to the checkpoints of the slice, the newest first.
+QVector<int> Shard::checkpointSteps()
+{
+	QVector<int> steps;
+	if (!o.checkpoint)
+		return steps;
+	QString names[] = { checkpointFile, checkpointFile + ".prev" };
+	for (int k = 0; k < 2; k++) {
+		QFile file(names[k]);
+		if (!file.open(QIODevice::ReadOnly))
+			continue;
+		QDataStream in(&file);
+		int done, size;
+		in >> done >> size;
+		if (in.status() == QDataStream::Ok && size == ensemble.size())
+			steps.append(done);
+	}
+	return steps;
+}
+
+// The steps to resume from: the newest checkpoint or, when the shards must
+// agree, the newest checkpoint of every shard at the lowest of theirs. The
+// common point only ever goes down, to 0 at worst, and every shard makes
+// the same calls to lowest, so they all leave the loop together.
+int Shard::agreeCheckpoint()
+{
+	QVector<int> steps = checkpointSteps();
+	int done = steps.isEmpty() ? 0 : steps[0];
+	if (!lowest)
+		return done;
+	for (;;) {
+		int common = lowest(done);
+		done = 0;
+		for (int k = 0; k < steps.size(); k++)
+			if (steps[k] <= common) {
+				done = steps[k];
+				break;
+			}
+		if (lowest(done == common ? 1 : 0) == 1)
+			return done;
+	}
+}
+
+// Loads the checkpoint taken after the given steps; 0 leaves the slice as
+// set up. Returns the steps done.
+int Shard::loadCheckpoint(int done)
+{
+	if (done == 0)
+		return 0;
+	QFile file(checkpointFile);
+	if (!file.open(QIODevice::ReadOnly))
+		return 0;
+	QDataStream in(&file);
+	int steps, size;
+	in >> steps >> size;
+	if (steps != done) {
+		file.close();
+		file.setFileName(checkpointFile + ".prev");
+		if (!file.open(QIODevice::ReadOnly))
+			return 0;
+		in.setDevice(&file);
+		in >> steps >> size;
+	}
+	if (steps != done || size != ensemble.size())
+		return 0;
+	QByteArray shared;
+	in >> shared;
+	QVector<QByteArray> states(size);
+	for (int i = 0; i < size; i++)
+		in >> states[i];
+	if (in.status() != QDataStream::Ok)
+		return 0;
+	QDataStream sampling(shared);
+	ensemble.loadState(sampling);
+	ensemble.forEachMember([&states](int i, Model *model) {
+		QDataStream state(states[i]);
+		model->loadState(state);
+	});
+	return done;
+}
+
+void Shard::saveCheckpoint(int done)
+{
+	QVector<QByteArray> states(ensemble.size());
+	ensemble.forEachMember([&states](int i, Model *model) {
+		QDataStream state(&states[i], QIODevice::WriteOnly);
+		model->saveState(state);
+	});
+	QByteArray shared;
+	QDataStream sampling(&shared, QIODevice::WriteOnly);
+	ensemble.saveState(sampling);
+
+	// write aside and rename, so that a crash never leaves a torn checkpoint
+	QFile file(checkpointFile + ".tmp");
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return;
+	QDataStream out(&file);
+	out << done << ensemble.size() << shared;
+	for (int i = 0; i < states.size(); i++)
+		out << states[i];
+	file.close();
+	// the previous one stays, for shards which must agree on a step
+	QFile::remove(checkpointFile + ".prev");
+	QFile::rename(checkpointFile, checkpointFile + ".prev");
+	QFile::rename(checkpointFile + ".tmp", checkpointFile);
+}
+
+void Shard::sampleSums(double *row)
+{
+	int columns = o.columns();
+	for (int c = 0; c < columns; c++)
+		row[c] = 0;
+	double *isotropy = row + (o.binned() ? 2 : 1);
+	double *flight = isotropy + (o.angleBins > 0 ? 1 : 0);
+	double *bins = flight + (o.flights.isEmpty() ? 0 : 2);
+	for (int i = 0; i < ensemble.size(); i++) {
+		Model *model = ensemble.getModel(i);
+		if (model->timeFull > 0)
+			row[0] += model->impulseSum / (model->timeFull / 100.0);
+		if (o.binned())
+			row[1] += model->entropy();
+		if (o.angleBins > 0)
+			*isotropy += model->isotropy();
+		if (!o.flights.isEmpty()) {
+			flight[0] += model->meanFreePath();
+			flight[1] += model->collisionFrequency();
+		}
+		// the step left the counts up to date
+		const QVector<int>& counts = model->occupancy();
+		int num = model->getNumber();
+		if (num > 0)
+			for (int b = 0; b < counts.size(); b++)
+				bins[b] += qreal(counts[b]) / num;
+	}
+}
+
+// Steps the slice until o.steps or, when asked, its equilibrium.
+int Shard::run(double *sums, double *equilibration, double *flights, int *stored)
+{
+	setUp();
+	int done = loadCheckpoint(agreeCheckpoint());
+	resumed = done / o.every;
+	*stored = resumed;
+	QElapsedTimer clock;
+	qint64 stepping = 0;	// ns
+	int stepped = 0;
+	for (int k = done; k < o.steps; k++) {
+		clock.start();
+		ensemble.step(o.dt);
+		stepping += clock.nsecsElapsed();
+		stepped++;
+		bool stop = false;
+		if ((k + 1) % o.every == 0) {
+			int sample = (k + 1) / o.every;
+			sampleSums(sums + (sample - 1) * o.columns());
+			*stored = sample;
+			stop = onSample ? onSample(sample) : o.equilibrated > 0 && ensemble.isEquilibrated();
+		}
+		// after the sample, which a restart counts as stored
+		if (o.checkpoint && (k + 1) % o.checkpoint == 0)
+			saveCheckpoint(k + 1);
+		if (stop)
+			break;
+	}
+
+	QVector<qreal> times = ensemble.equilibrationTimes();
+	for (int i = 0; i < times.size(); i++)
+		equilibration[first + i] = times[i];
+	for (int k = 0; k < flightSlots(); k++)
+		flights[k] = 0;
+	for (int i = 0; i < ensemble.size(); i++) {
+		const Model *model = ensemble.getModel(i);
+		for (int b = 0; b < Model::FLIGHT_BINS; b++)
+			flights[b] += model->flightHistogram().count(b);
+		qint64 whole = model->flightHistogram().total();
+		flights[Model::FLIGHT_BINS] += whole;
+		flights[Model::FLIGHT_BINS + 1] += model->meanFreeTime() * whole;
+		flights[Model::FLIGHT_BINS + 2] += model->collisionFrequency();
+	}
+	if (index == 0) {
+		double particleSteps = double(stepped) * ensemble.size() * o.electrons;
+		fprintf(stderr, "lorentz: %d steps in %.3f s, %.1f ns per particle step\n", stepped, stepping * 1e-9,
+			particleSteps > 0 ? stepping / particleSteps : 0);
+		if (ensemble.size() > 0) {
+			fprintf(stderr, "lorentz: %s\n", qPrintable(ensemble.describeHistory()));
+			fprintf(stderr, "lorentz: %s\n", qPrintable(ensemble.describeErgodicity()));
+			fprintf(stderr, "lorentz: member 0: %s\n", qPrintable(ensemble.getModel(0)->describeCorrelation()));
+			fprintf(stderr, "lorentz: member 0: %s\n", qPrintable(ensemble.getModel(0)->describeCollisions()));
+		}
+	}
+	return 0;
+}
+
+// Writes the "t,pressure" lines of the ensemble average.
+class ResultWriter
+{
+public:
+	ResultWriter(const HeadlessOptions& options) : o(options) {}
+
+	bool open();
+	void write(int sample, const double *sums);	// o.columns() sums over all members
+
+private:
+	const HeadlessOptions& o;
+	QFile file;
+	QTextStream out;
+};
+
+bool ResultWriter::open()
+{
+	bool opened;
+	if (o.output == "-")
+		opened = file.open(stdout, QIODevice::WriteOnly);
+	else {
+		file.setFileName(o.output);
+		opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+	}
+	if (!opened) {
+		fprintf(stderr, "lorentz: cannot write %s\n", qPrintable(o.output));
+		return false;
+	}
+	out.setDevice(&file);
+	out << "t,pressure";
+	if (o.binned())
+		out << ",entropy";
+	if (o.angleBins > 0)
+		out << ",isotropy";
+	if (!o.flights.isEmpty())
+		out << ",free_path,collision_rate";
+	for (int b = 0; b < o.bins * o.bins; b++)
+		out << ",bin" << b;
+	out << "\n";
+	return true;
+}
+
+void ResultWriter::write(int sample, const double *sums)
+{
+	double s = o.speed * o.dt / 1000;
+	out << (sample + 1) * o.every * s / 100.0;
+	for (int c = 0; c < o.columns(); c++)
+		out << "," << sums[c] / o.members;
+	out << "\n";
+}
+
+// Writes the samples all the shards stored.
+static bool writeResults(const HeadlessOptions& o, const double *sums, int samples, int stored)
+{
+	ResultWriter writer(o);
+	if (!writer.open())
+		return false;
+	int columns = o.columns();
+	QVector<double> row(columns);
+	for (int k = 0; k < stored; k++) {
+		row.fill(0);
+		for (int p = 0; p < o.processes; p++)
+			for (int c = 0; c < columns; c++)
+				row[c] += sums[(p * samples + k) * columns + c];
+		writer.write(k, row.data());
+	}
+	return true;
+}
+
+// Writes the histogram of the equilibration times as "t,members" lines.
+static bool writeEquilibration(const HeadlessOptions& o, const double *times)
+{
+	QVector<qreal> reached;
+	for (int i = 0; i < o.members; i++)
+		if (times[i] >= 0)
+			reached.append(times[i]);
+	fprintf(stderr, "lorentz: %d of %d members in equilibrium\n", reached.size(), o.members);
+	if (o.equilibration.isEmpty())
+		return true;
+
+	QFile file(o.equilibration);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		fprintf(stderr, "lorentz: cannot write %s\n", qPrintable(o.equilibration));
+		return false;
+	}
+	QTextStream out(&file);
+	out << "t,members\n";
+	Histogram h = Histogram::of(reached, EQUILIBRATION_BINS);
+	for (int i = 0; i < h.bins(); i++)
+		out << h.center(i) << "," << h.count(i) << "\n";
+	return true;
+}
+
+// Writes the histogram of the free-flight times of all the members as
+// "t,flights" lines; flights holds the flightSlots() summed over the shards.
+static bool writeFlights(const HeadlessOptions& o, const double *flights)
+{
+	double whole = flights[Model::FLIGHT_BINS];
+	double meanTime = whole > 0 ? flights[Model::FLIGHT_BINS + 1] / whole : 0;
+	fprintf(stderr, "lorentz: %.0f free flights, mean free path %g, collision frequency %g\n",
+		whole, meanTime * 100, flights[Model::FLIGHT_BINS + 2] / o.members);
+	if (o.flights.isEmpty())
+		return true;
+
+	QFile file(o.flights);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		fprintf(stderr, "lorentz: cannot write %s\n", qPrintable(o.flights));
+		return false;
+	}
+	QTextStream out(&file);
+	out << "t,flights\n";
+	// the bins every member used
+	Histogram h(0, qMax(o.width, o.height) / 100.0, Model::FLIGHT_BINS);
+	for (int b = 0; b < h.bins(); b++)
+		out << h.center(b) << "," << qint64(flights[b]) << "\n";
+	return true;
+}
+
+// Where the shards leave their results; shared with the forked ones.
+struct ShardResults
+{
+	double *sums;		// samples x columns per shard, shard after shard
+	double *equilibration;	// per member, -1 until in equilibrium
+	double *flights;	// flightSlots() per shard
+	int *stored;		// samples stored per shard
+	int *equilibrated;	// samples x shards, members in equilibrium
+	QAtomicInt *counted;	// samples in equilibrated per shard
+};
+
+// The first sample (from 1) at which the shards together have enough
+// members in equilibrium, -1 when there is none among the samples every
+// shard has counted. Scans on from *from, which is left at the sample
+// found or past the samples scanned.
+static int globalEquilibrium(const HeadlessOptions& o, const ShardResults& r, int *from)
+{
+	int common = INT_MAX;
+	for (int p = 0; p < o.processes; p++)
+		common = qMin(common, r.counted[p].loadAcquire());
+	int needed = qCeil(o.equilibrated * o.members);
+	for (; *from < common; ++*from) {
+		int all = 0;
+		for (int p = 0; p < o.processes; p++)
+			all += r.equilibrated[*from * o.processes + p];
+		if (all >= needed)
+			return *from + 1;
+	}
+	return -1;
+}
+
+#ifdef Q_OS_UNIX
+static pid_t forkShard(const HeadlessOptions& o, int index, const ShardResults& r, int samples)
+{
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == 0) {
+		int code;
+		{
+			Shard shard(o, index, o.processes, index, o.processes);
+			// like the MPI ranks, the shards stop on the equilibrium of
+			// the whole ensemble; those ahead see it late and run past it
+			int from = 0;
+			if (o.equilibrated > 0)
+				shard.onSample = [&](int done) {
+					r.equilibrated[(done - 1) * o.processes + index] = shard.equilibrated();
+					r.counted[index].storeRelease(done);
+					int reached = globalEquilibrium(o, r, &from);
+					return reached > 0 && done >= reached;
+				};
+			code = shard.run(r.sums + index * samples * o.columns(), r.equilibration,
+				r.flights + index * flightSlots(), r.stored + index);
+		}
+		_exit(code);
+	}
+	return pid;
+}
+
+// The coordinator forks one process per shard. The shards write their
+// results straight into a shared anonymous mapping; a shard which dies is
+// forked again and resumes from its last checkpoint.
+static int runProcesses(const HeadlessOptions& o, const ShardResults& r, int samples)
+{
+	QVector<pid_t> pids(o.processes);
+	QVector<int> restarts(o.processes, 0);
+	for (int p = 0; p < o.processes; p++)
+		pids[p] = forkShard(o, p, r, samples);
+
+	int failed = 0;
+	int running = o.processes;
+	while (running > 0) {
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		int p = pids.indexOf(pid);
+		if (p < 0)
+			continue;
+		running--;
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			continue;
+		if (restarts[p]++ < o.retries) {
+			fprintf(stderr, "lorentz: shard %d died, restarting\n", p);
+			pids[p] = forkShard(o, p, r, samples);
+			running++;
+		}
+		else {
+			fprintf(stderr, "lorentz: shard %d failed\n", p);
+			failed++;
+		}
+	}
+	return failed;
+}
+#endif
+
+#ifdef LORENTZ_MPI
+// Every rank simulates a slice of the members; the per-sample pressure sums
+// are reduced to rank 0 every o.reduce samples and written there. The
+// equilibrium of the whole ensemble is decided at the same points.
+static int runMpi(const HeadlessOptions& o, int samples)
+{
+	int rank, size;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	// ranks on the same host split its CPUs between them
+	MPI_Comm host;
+	int hostRank, hostSize;
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &host);
+	MPI_Comm_rank(host, &hostRank);
+	MPI_Comm_size(host, &hostSize);
+	MPI_Comm_free(&host);
+
+	// the ranks past the members get empty slices; they still take part
+	// in every reduction, with zero sums
+	if (rank == 0 && size > o.members)
+		fprintf(stderr, "lorentz: %d ranks for %d members, %d of them idle\n", size, o.members,
+			size - o.members);
+
+	long long id = runId;
+	MPI_Bcast(&id, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+	runId = id;
+
+	ResultWriter writer(o);
+	int failed = rank == 0 && !writer.open();
+
+	int columns = o.columns();
+	QVector<double> sums(samples * columns);
+	QVector<double> total(o.reduce * columns);
+	QVector<double> times(o.members, -1);
+	int reduced = -1;
+	int stored = 0;
+	Shard shard(o, rank, size, hostRank, hostSize);
+	shard.lowest = [](int value) {
+		int all;
+		MPI_Allreduce(&value, &all, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+		return all;
+	};
+	shard.onSample = [&](int done) {
+		// all the ranks resumed at the same sample; those before it are
+		// not in sums, and were written by the run which died
+		if (reduced < 0)
+			reduced = shard.resumedSamples();
+		if (done - reduced < o.reduce && done < samples)
+			return false;
+		int n = done - reduced;
+		MPI_Reduce(sums.data() + reduced * columns, total.data(), n * columns, MPI_DOUBLE, MPI_SUM, 0,
+			MPI_COMM_WORLD);
+		if (rank == 0 && !failed)
+			for (int k = 0; k < n; k++)
+				writer.write(reduced + k, total.data() + k * columns);
+		reduced = done;
+		if (o.equilibrated <= 0)
+			return false;
+		int local = shard.equilibrated(), all;
+		MPI_Allreduce(&local, &all, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+		return all >= qCeil(o.equilibrated * o.members);
+	};
+	QVector<double> flights(flightSlots());
+	failed |= shard.run(sums.data(), times.data(), flights.data(), &stored);
+
+	// every rank filled in its own members
+	QVector<double> allTimes(o.members);
+	MPI_Reduce(times.data(), allTimes.data(), o.members, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	if (rank == 0 && !failed && !writeEquilibration(o, allTimes.data()))
+		failed = 1;
+	QVector<double> allFlights(flightSlots());
+	MPI_Reduce(flights.data(), allFlights.data(), flightSlots(), MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (rank == 0 && !failed && !writeFlights(o, allFlights.data()))
+		failed = 1;
+
+	int anyFailed;
+	MPI_Allreduce(&failed, &anyFailed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	QFile::remove(checkpointName(o, rank));
+	QFile::remove(checkpointName(o, rank) + ".prev");
+	if (rank == 0)
+		fprintf(stderr, "lorentz: %s\n", qPrintable(describeArenas()));
+	return anyFailed;
+}
+#endif
+
+int runHeadless(const QStringList& args)
+{
+	HeadlessOptions o;
+	QString error;
+	if (!o.parse(args, &error)) {
+		fprintf(stderr, "lorentz: %s\n", qPrintable(error));
+		return 2;
+	}
+
+	runId = o.runId ? o.runId : QCoreApplication::applicationPid();
+	int samples = o.steps / o.every;
+
+#ifdef LORENTZ_MPI
+	MPI_Init(NULL, NULL);
+	if (o.processes > 1)
+		fprintf(stderr, "lorentz: --processes is ignored under MPI\n");
+	o.processes = 1;
+	int mpiFailed = runMpi(o, samples);
+	MPI_Finalize();
+	return mpiFailed ? 1 : 0;
+#endif
+
+#ifndef Q_OS_UNIX
+	o.processes = 1;
+#endif
+	size_t bytes = sizeof(double) * (size_t(samples) * o.processes * o.columns() + o.members
+		+ o.processes * flightSlots()) + sizeof(int) * (o.processes + size_t(samples) * o.processes)
+		+ sizeof(QAtomicInt) * o.processes;
+	void *block;
+	int failed = 0;
+#ifdef Q_OS_UNIX
+	if (o.processes > 1) {
+		block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED) {
+			fprintf(stderr, "lorentz: cannot map %lu bytes of shared memory\n", (unsigned long)bytes);
+			return 1;
+		}
+	}
+	else
+#endif
+		block = calloc(bytes, 1);
+
+	ShardResults r;
+	r.sums = (double *)block;
+	r.equilibration = r.sums + size_t(samples) * o.processes * o.columns();
+	r.flights = r.equilibration + o.members;
+	r.stored = (int *)(r.flights + o.processes * flightSlots());
+	r.equilibrated = r.stored + o.processes;
+	r.counted = (QAtomicInt *)(r.equilibrated + size_t(samples) * o.processes);
+	for (int p = 0; p < o.processes; p++)
+		new (r.counted + p) QAtomicInt(0);
+	for (int i = 0; i < o.members; i++)
+		r.equilibration[i] = -1;
+
+#ifdef Q_OS_UNIX
+	if (o.processes > 1)
+		failed = runProcesses(o, r, samples);
+	else
+#endif
+	{
+		Shard shard(o, 0, 1, 0, 1);
+		failed = shard.run(r.sums, r.equilibration, r.flights, r.stored);
+	}
+
+	// shards stopped by the equilibrium may have stored fewer samples, and
+	// the output ends where the whole ensemble got there
+	int stored = samples;
+	for (int p = 0; p < o.processes; p++)
+		stored = qMin(stored, r.stored[p]);
+	if (o.processes > 1 && o.equilibrated > 0) {
+		int from = 0;
+		int reached = globalEquilibrium(o, r, &from);
+		if (reached > 0)
+			stored = qMin(stored, reached);
+	}
+	if (!failed && !writeResults(o, r.sums, samples, stored))
+		failed = 1;
+	if (!failed && !writeEquilibration(o, r.equilibration))
+		failed = 1;
+	QVector<double> flights(flightSlots(), 0);
+	for (int p = 0; p < o.processes; p++)
+		for (int k = 0; k < flightSlots(); k++)
+			flights[k] += r.flights[p * flightSlots() + k];
+	if (!failed && !writeFlights(o, flights.data()))
+		failed = 1;
+
+	for (int p = 0; p < o.processes; p++) {
+		QFile::remove(checkpointName(o, p));
+		QFile::remove(checkpointName(o, p) + ".prev");
+	}
+	fprintf(stderr, "lorentz: %s\n", qPrintable(describeArenas()));
+#ifdef Q_OS_UNIX
+	if (o.processes > 1)
+		munmap(block, bytes);
+	else
+#endif
+		free(block);
+	return failed ? 1 : 0;
+}
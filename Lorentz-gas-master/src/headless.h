@@ -0,0 +1,70 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <QString>
+#include <QStringList>
+
+// Settings of a run without the GUI:
+//   lorentz --headless [--members N] [--electrons N] [--steps N] ...
+// The ensemble-averaged pressure is written as "t,pressure" lines, followed
+// by the mean coarse-grained entropy with --bins or --angle-bins, the mean
+// chi-square of the directions against isotropy with --angle-bins, the mean
+// free path and collision frequency with --flights and the mean occupancy of
+// every bin with --bins. The first shard reports on stderr the time spent
+// stepping, samples included, per particle step; the same run with and
+// without --bins or --angle-bins gives the cost of the binning.
+struct HeadlessOptions
+{
+	HeadlessOptions();
+	bool parse(const QStringList& args, QString *error);
+
+	int members;
+	int electrons;
+	int side;
+	double atomR;
+	double electronR;
+	double speed;
+	int width;
+	int height;
+
+	int steps;		// number of steps of dt milliseconds
+	int dt;
+	int every;		// steps between two output samples
+	int seed;
+	int bins;		// occupancy bins per side, 0 for none
+	int angleBins;		// direction bins, 0 for none
+
+	int processes;		// worker processes, each simulating a slice of members
+	int checkpoint;		// steps between two shard checkpoints, 0 for none
+	int retries;		// restarts allowed per worker process
+	int reduce;		// samples between two MPI reductions (CONFIG+=mpi builds)
+
+	QString output;		// "-" for stdout
+	QString scratch;	// directory for checkpoints
+	qint64 runId;		// names the checkpoints, the process id when 0; a run
+				// given the id of one that died resumes from its checkpoints
+	QString history;	// directory for history files, empty to keep them in RAM
+	int historyBudget;	// MiB of RAM for the histories of the run, 0 for the default
+
+	QString equilibrium;	// detection method of every member
+	QString signal;		// what it looks at, pressure or entropy
+	QString rate;		// what the members record, the pressure since the
+				// start (cumulative) or since the last sample (windowed)
+	double equilibrated;	// stop once this fraction of the members is in equilibrium, 0 never
+	QString equilibration;	// file for the "t,members" histogram of equilibration times
+	QString flights;	// file for the "t,flights" histogram of free-flight times
+
+	// Values per output sample: the pressure, the entropy while binned, the
+	// isotropy, the free path and collision frequency, and the bin
+	// occupancies.
+	bool binned() const { return bins > 0 || angleBins > 0; }
+	int columns() const
+	{
+		return 1 + (binned() ? 1 : 0) + (angleBins > 0 ? 1 : 0) + (flights.isEmpty() ? 0 : 2) + bins * bins;
+	}
+};
+
+// Entry point of "lorentz --headless"; returns the process exit code.
+int runHeadless(const QStringList& args);
+
+#endif
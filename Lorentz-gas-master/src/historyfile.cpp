@@ -0,0 +1,142 @@
+#include <QtGlobal>
+#include <QFile>
+#include "historyfile.h"
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+const qint64 HistoryFile::RESIDENT_BYTES = 8 * 1024 * 1024;
+
+static const qint64 INITIAL_LENGTH = 1024 * 1024;
+
+struct HistoryFile::Header
+{
+	char magic[8];		// "LZHIST1"
+	qint32 recordSize;
+	qint32 reserved;
+	qint64 count;		// complete records
+	char padding[40];	// records start 64-byte aligned
+};
+
+HistoryFile::HistoryFile()
+	: recordSize(0), map(NULL), mapped(0), evicted(0)
+{
+}
+
+HistoryFile::~HistoryFile()
+{
+	close();
+}
+
+bool HistoryFile::open(const QString& name, int size)
+{
+	close();
+	path = name;
+	recordSize = size;
+	if (!remap(INITIAL_LENGTH))
+		return false;
+	Header *header = (Header *)map;
+	memset(header, 0, sizeof(Header));
+	memcpy(header->magic, "LZHIST1", 8);
+	header->recordSize = recordSize;
+	return true;
+}
+
+void HistoryFile::close()
+{
+#ifdef Q_OS_UNIX
+	if (map)
+		munmap(map, mapped);
+#endif
+	map = NULL;
+	mapped = 0;
+	evicted = 0;
+}
+
+void HistoryFile::truncate()
+{
+	if (!map)
+		return;
+	((Header *)map)->count = 0;
+	evicted = 0;
+}
+
+qint64 HistoryFile::count() const
+{
+	return map ? ((const Header *)map)->count : 0;
+}
+
+const char *HistoryFile::records() const
+{
+	return map ? map + sizeof(Header) : NULL;
+}
+
+bool HistoryFile::append(const void *record)
+{
+	if (!map)
+		return false;
+	qint64 n = count();
+	qint64 end = sizeof(Header) + (n + 1) * recordSize;
+	if (end > mapped && !remap(qMax(end, 2 * mapped)))
+		return false;
+	memcpy(map + sizeof(Header) + n * recordSize, record, recordSize);
+	// the record is complete before it is counted
+	((Header *)map)->count = n + 1;
+	if (end - evicted > 2 * RESIDENT_BYTES)
+		release();
+	return true;
+}
+
+// Grows the file to length bytes and maps it again. The descriptor is only
+// held while remapping, so that thousands of histories do not run out of
+// file descriptors.
+bool HistoryFile::remap(qint64 length)
+{
+#ifdef Q_OS_UNIX
+	int fd = ::open(QFile::encodeName(path).constData(), O_RDWR | O_CREAT | (map ? 0 : O_TRUNC), 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, length) != 0) {
+		::close(fd);
+		return false;
+	}
+	void *p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	if (map)
+		munmap(map, mapped);
+	map = (char *)p;
+	mapped = length;
+	return true;
+#else
+	Q_UNUSED(length);
+	return false;
+#endif
+}
+
+// Hands the written pages behind the resident tail back to the OS. The
+// mapping is shared, so their contents stay in the file.
+void HistoryFile::release()
+{
+#ifdef Q_OS_UNIX
+	long page = sysconf(_SC_PAGESIZE);
+	qint64 end = sizeof(Header) + count() * recordSize - RESIDENT_BYTES;
+	qint64 from = qMax<qint64>(evicted, page);	// keep the header page
+	from = (from + page - 1) / page * page;
+	end = end / page * page;
+	if (end > from)
+		madvise(map + from, end - from, MADV_DONTNEED);
+	evicted = qMax(evicted, end);
+#endif
+}
+
+QString historyDirectory()
+{
+	return QString::fromLocal8Bit(qgetenv("LORENTZ_HISTORY_DIR"));
+}
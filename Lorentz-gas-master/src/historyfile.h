@@ -0,0 +1,56 @@
+#ifndef HISTORYFILE_H
+#define HISTORYFILE_H
+
+#include <QtGlobal>
+#include <QString>
+
+// Append-only file of fixed-size records mapped into memory, used to keep
+// histories out of RAM on very long runs. The file starts with a small
+// header holding the record size and the number of complete records, which
+// is updated after every append, so the file is a valid record of the run
+// up to the last sample even if the process dies.
+// Only the recent tail is kept resident; the pages behind it are handed
+// back to the OS and fault in from the file when read again.
+class HistoryFile
+{
+public:
+	HistoryFile();
+	~HistoryFile();
+
+	// Creates (or truncates) the file. Returns false when it cannot be
+	// mapped, or on systems without mmap.
+	bool open(const QString& path, int recordSize);
+	void close();
+	bool isOpen() const { return map != NULL; }
+	QString fileName() const { return path; }
+
+	// Drops every record.
+	void truncate();
+	// Copies one record to the end of the file.
+	bool append(const void *record);
+
+	qint64 count() const;
+	// The records, contiguous. Appending may move them.
+	const char *records() const;
+
+	// Bytes at the end of the file kept resident.
+	static const qint64 RESIDENT_BYTES;
+
+private:
+	struct Header;
+
+	bool remap(qint64 length);
+	void release();
+
+	QString path;
+	int recordSize;
+	char *map;
+	qint64 mapped;		// length of the file and of the mapping
+	qint64 evicted;		// the file below this offset was released
+};
+
+// Directory for history files, from LORENTZ_HISTORY_DIR; empty when the
+// histories are kept in RAM.
+QString historyDirectory();
+
+#endif
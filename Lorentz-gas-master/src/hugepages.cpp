@@ -0,0 +1,160 @@
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include "hugepages.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+static QMutex registryMutex;
+static QMap<quintptr, size_t> registry;	// arena address -> mapped length
+static int mode = -1;
+
+HugePageMode hugePageMode()
+{
+	QMutexLocker locker(&registryMutex);
+	if (mode < 0) {
+		QByteArray env = qgetenv("LORENTZ_HUGEPAGES");
+		if (env == "off")
+			mode = HugePagesOff;
+		else if (env == "hugetlb")
+			mode = HugePagesExplicit;
+		else
+			mode = HugePagesTransparent;
+	}
+	return HugePageMode(mode);
+}
+
+void setHugePageMode(HugePageMode newMode)
+{
+	QMutexLocker locker(&registryMutex);
+	mode = newMode;
+}
+
+static size_t roundUp(size_t bytes)
+{
+	return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+void *arenaAllocate(size_t bytes)
+{
+	HugePageMode current = hugePageMode();
+	if (bytes < HUGE_PAGE_SIZE || current == HugePagesOff)
+		return malloc(bytes);
+
+#ifdef Q_OS_LINUX
+	size_t length = roundUp(bytes);
+	void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (current == HugePagesExplicit)
+		p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (p == MAP_FAILED) {
+		// over-allocate so that the arena can start on a huge page boundary
+		size_t mapped = length + HUGE_PAGE_SIZE;
+		char *raw = (char *)mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED)
+			return NULL;
+		char *aligned = (char *)roundUp((size_t)raw);
+		if (aligned > raw)
+			munmap(raw, aligned - raw);
+		if (raw + mapped > aligned + length)
+			munmap(aligned + length, raw + mapped - (aligned + length));
+		p = aligned;
+#ifdef MADV_HUGEPAGE
+		madvise(p, length, MADV_HUGEPAGE);
+#endif
+	}
+
+	QMutexLocker locker(&registryMutex);
+	registry.insert((quintptr)p, length);
+	return p;
+#else
+	return malloc(bytes);
+#endif
+}
+
+void arenaFree(void *p, size_t bytes)
+{
+	if (!p)
+		return;
+#ifdef Q_OS_LINUX
+	if (bytes >= HUGE_PAGE_SIZE) {
+		registryMutex.lock();
+		QMap<quintptr, size_t>::iterator it = registry.find((quintptr)p);
+		if (it != registry.end()) {
+			size_t length = it.value();
+			registry.erase(it);
+			registryMutex.unlock();
+			munmap(p, length);
+			return;
+		}
+		registryMutex.unlock();
+	}
+#else
+	Q_UNUSED(bytes);
+#endif
+	free(p);
+}
+
+ArenaStats arenaStats()
+{
+	ArenaStats stats;
+	stats.arenas = 0;
+	stats.bytes = 0;
+	stats.hugeBytes = 0;
+	stats.pageSize = 0;
+
+	QMutexLocker locker(&registryMutex);
+	QMap<quintptr, size_t>::const_iterator it;
+	for (it = registry.constBegin(); it != registry.constEnd(); ++it) {
+		stats.arenas++;
+		stats.bytes += it.value();
+	}
+
+#ifdef Q_OS_LINUX
+	FILE *smaps = fopen("/proc/self/smaps", "r");
+	if (!smaps)
+		return stats;
+	char line[512];
+	bool inArena = false;
+	unsigned long start, end;
+	size_t kb;
+	while (fgets(line, sizeof(line), smaps)) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			// the first mapping line of a new region
+			it = registry.upperBound(end - 1);
+			inArena = it != registry.constBegin() && (--it).key() + it.value() > start;
+		}
+		else if (!inArena) {
+			continue;
+		}
+		else if (sscanf(line, "KernelPageSize: %zu kB", &kb) == 1) {
+			stats.pageSize = qMax(stats.pageSize, kb * 1024);
+			if (kb * 1024 >= HUGE_PAGE_SIZE)
+				stats.hugeBytes += end - start;
+		}
+		else if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1 && kb > 0) {
+			stats.pageSize = qMax(stats.pageSize, HUGE_PAGE_SIZE);
+			stats.hugeBytes += kb * 1024;
+		}
+	}
+	fclose(smaps);
+#endif
+	return stats;
+}
+
+QString describeArenas()
+{
+	ArenaStats stats = arenaStats();
+	return QString("%1 arenas, %2 MiB, %3 MiB on huge pages, page size %4 KiB (compressed histories on the heap)")
+			.arg(stats.arenas)
+			.arg(qulonglong(stats.bytes >> 20))
+			.arg(qulonglong(stats.hugeBytes >> 20))
+			.arg(qulonglong(stats.pageSize >> 10));
+}
@@ -0,0 +1,83 @@
+#ifndef HUGEPAGES_H
+#define HUGEPAGES_H
+
+#include <QtGlobal>
+#include <QString>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Large arenas (particle state, uncompressed measurement history) are
+// mapped on 2 MiB pages to keep the TLB from thrashing when big ensembles
+// are walked. The sealed blocks of a CompressedHistory, a few KiB each and
+// only read when plotted, stay on the heap and are not counted here.
+// The mode is taken from LORENTZ_HUGEPAGES=off|thp|hugetlb (thp by default):
+//   thp     - anonymous mapping with madvise(MADV_HUGEPAGE)
+//   hugetlb - explicit MAP_HUGETLB pages, falling back to thp when the
+//             hugetlbfs pool is empty
+// Allocations smaller than one huge page always come from the heap.
+
+enum HugePageMode {
+	HugePagesOff,
+	HugePagesTransparent,
+	HugePagesExplicit
+};
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+HugePageMode hugePageMode();
+void setHugePageMode(HugePageMode mode);
+
+void *arenaAllocate(size_t bytes);
+void arenaFree(void *p, size_t bytes);
+
+struct ArenaStats
+{
+	int arenas;		// live arenas of at least HUGE_PAGE_SIZE
+	size_t bytes;		// bytes mapped for them
+	size_t hugeBytes;	// of which actually backed by huge pages
+	size_t pageSize;	// largest page size obtained
+};
+
+// Queries the kernel (/proc/self/smaps) for the pages the arenas got.
+ArenaStats arenaStats();
+// Says what arenaStats() found; the heap, compressed histories included,
+// is left out.
+QString describeArenas();
+
+template <typename T>
+class HugePageAllocator
+{
+public:
+	typedef T value_type;
+
+	HugePageAllocator() {}
+	template <typename U>
+	HugePageAllocator(const HugePageAllocator<U>&) {}
+
+	T *allocate(size_t n)
+	{
+		void *p = arenaAllocate(n * sizeof(T));
+		if (!p)
+			throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T *p, size_t n)
+	{
+		arenaFree(p, n * sizeof(T));
+	}
+
+	template <typename U>
+	struct rebind { typedef HugePageAllocator<U> other; };
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return false; }
+
+template <typename T>
+using HugeVector = std::vector<T, HugePageAllocator<T> >;
+
+#endif
@@ -1,9 +1,16 @@
 #include <QApplication>
 #include <QTranslator>
 #include "window.h"
+#include "headless.h"
 
 int main(int argc, char *argv[])
 {
+	QStringList args;
+	for (int i = 0; i < argc; i++)
+		args << QString::fromLocal8Bit(argv[i]);
+	if (args.contains("--headless"))
+		return runHeadless(args);
+
 	QApplication app(argc, argv);
 
 	// Fixed russian translation
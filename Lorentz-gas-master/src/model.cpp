@@ -6,11 +6,18 @@
 #include <math.h>
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
 using namespace std;
 
-const int Model::MAX_HISTORY = 10000000;
+// whole blocks, so that every history drops the same samples
+const int Model::MAX_HISTORY = 9765 * CompressedHistory::BLOCK;
 const qreal Model::timeStep = 1.0;
 const qreal Model::measurePeriod = 20.0;
+const int Model::TILE_CELLS = 8;
+const int Model::PARALLEL_THRESHOLD = 4096;
+const int Model::ENTROPY_RESUM = 1024;
+const int Model::ENTROPY_TABLE = 65536;
+const int Model::FLIGHT_BINS = 40;
 
 #define sqr(x) ((x)*(x))
 
@@ -21,8 +28,10 @@ Model::Model()
 	atomR = 5;
 	electronR = 2;
 	speed = 100;
+	width = height = 0;
 
     num = 0;
+    generator.seed(1);
 
 	paintTraceOnly = false;
 
@@ -37,11 +46,24 @@ Model::Model()
 	xBegin = xBegin ? xBegin : side;
 	yBegin = yBegin ? yBegin : side;
 
+	tilesX = tilesY = 1;
+	tilesDirty = true;
+
+	binsNumber = 0;
+	angleBins = 0;
+	binIndex = 0;
+	showBins = false;
+	binScaleX = binScaleY = 0;
+	cellSum = 0;
+	stepsSinceResum = 0;
+	binsDirty = true;
+
+	detector.setMethod(EquilibriumDetector::defaultMethod());
 	clear();
 }
 
 
-Model::Model(const Model& copied)
+Model::Model(const Model& copied, quint32 seed)
 {
     // default parameters
     side = copied.side;
@@ -50,6 +72,7 @@ Model::Model(const Model& copied)
     speed = copied.speed;
 
     num = 0;
+    generator.seed(seed);
 
     paintTraceOnly = false;
 
@@ -65,6 +88,20 @@ Model::Model(const Model& copied)
     xBegin = copied.xBegin;
     yBegin = copied.yBegin;
 
+    tilesX = tilesY = 1;
+    tilesDirty = true;
+
+    binIndex = copied.binIndex;
+    showBins = copied.showBins;
+    binsNumber = 0;
+    angleBins = copied.angleBins;
+    binScaleX = binScaleY = 0;
+    cellSum = 0;
+    stepsSinceResum = 0;
+    setBinsNumber(copied.binsNumber);
+
+    average = copied.average;
+    detector = copied.detector;
     clear();
     setNumber(copied.num);
 }
@@ -72,17 +109,41 @@ Model::Model(const Model& copied)
 
 void Model::add(int x, int y, qreal angle)
 {
-	positions.append(QPointF(x, y));
-	speedDir.append(angle);
+	positions.push_back(QPointF(x, y));
+	speedDir.push_back(angle);
+	flight.push_back(-1);
 	num++;
+	tilesDirty = true;
+	binsDirty = true;
 }
 
 void Model::clear()
 {
-    time.clear();
-    impulses.clear();
+    // back to the full capacity, which the ensemble budget may have lowered
+    pressures.setCapacity(MAX_HISTORY);
+    timeAveraged.setCapacity(MAX_HISTORY);
+    pressureLevels.setCapacity(MAX_HISTORY);
+    averagedLevels.setCapacity(MAX_HISTORY);
+    averagedErrors.setCapacity(MAX_HISTORY);
+    errorLevels.setCapacity(MAX_HISTORY);
+    entropies.setCapacity(MAX_HISTORY);
+    entropyLevels.setCapacity(MAX_HISTORY);
+    isotropies.setCapacity(MAX_HISTORY);
+    isotropyLevels.setCapacity(MAX_HISTORY);
+    for (int b = 0; b < binSeries.size(); b++) {
+        binSeries[b].setCapacity(MAX_HISTORY);
+        binLevels[b].setCapacity(MAX_HISTORY);
+    }
+    average.clear();
+    correlator.clear();
+    sampled.clear();
+    detector.clear();
+    resetFlights();
     timeFull = 0;
 	impulseSum = 0;
+	markTime = 0;
+	markImpulse = 0;
+	interval = 0;
 }
 
 int Model::getNumber() const
@@ -90,21 +151,12 @@ int Model::getNumber() const
 	return num;
 }
 
-QVector<qreal> Model::getTime() const
-{
-	return time;
-}
-
-QVector<qreal> Model::getImpulses() const
-{
-	return impulses;
-}
-
 void Model::setNumber(int newNum)
 {
 	while (newNum < num) {
 		positions.pop_back();
 		speedDir.pop_back();
+		flight.pop_back();
 		num--;
 	}
 	while (newNum > num) {
@@ -112,8 +164,8 @@ void Model::setNumber(int newNum)
 		// with random position and direction
 		qreal x, y;
 		for (int trial = 1; trial < 10; trial++) {
-			x = rand() % width;
-			y = rand() % height;
+			x = generator() % width;
+			y = generator() % height;
 
 			qreal xC1 = ceil((x-xBegin)/side) * side + xBegin;
 			qreal yC1 = ceil((y-yBegin)/side) * side + yBegin;
@@ -130,16 +182,25 @@ void Model::setNumber(int newNum)
 				qSqrt(sqr(x-xC4) + sqr(y-yC4)) > atomR + electronR)
 				break;
 		}
-		int angle = rand() % 360;
-		positions.append(QPointF(x, y));
-		speedDir.append((2*M_PI / 360) * angle);
+		int angle = generator() % 360;
+		positions.push_back(QPointF(x, y));
+		speedDir.push_back((2*M_PI / 360) * angle);
+		flight.push_back(-1);
 		num++;
 	}
+	tilesDirty = true;
+	binsDirty = true;
+}
+
+void Model::setSeed(quint32 seed)
+{
+	generator.seed(seed);
 }
 
 void Model::setSide(int val)
 {
 	side = val;
+	tilesDirty = true;
 }
 
 void Model::setAtomR(qreal val)
@@ -166,9 +227,37 @@ void Model::setDim(int w, int h)
 	yBegin = (height % side) / 2;
 	xBegin = xBegin ? xBegin : side;
 	yBegin = yBegin ? yBegin : side;
+	tilesDirty = true;
+	binsDirty = true;
+	resetFlights();
+}
+
+// The histogram spans the field, so it restarts with its size.
+void Model::resetFlights()
+{
+	flights = Histogram(0, qMax(width, height) / 100.0, FLIGHT_BINS);
+	collisions = 0;
+	flightSum = 0;
+}
+
+qreal Model::meanFreeTime() const
+{
+	qint64 whole = flights.total();
+	return whole > 0 ? flightSum / whole : 0;
+}
+
+qreal Model::collisionFrequency() const
+{
+	return num > 0 && timeFull > 0 ? collisions / (num * timeFull / 100.0) : 0;
+}
+
+QString Model::describeCollisions() const
+{
+	return QString("%1 scatterer collisions, mean free path %2, mean free time %3, collision frequency %4")
+		.arg(collisions).arg(meanFreePath()).arg(meanFreeTime()).arg(collisionFrequency());
 }
 
-void Model::checkBorders(QPointF& p, qreal& phi)
+qreal Model::checkBorders(QPointF& p, qreal& phi)
 {
 	int h = height;
 	int w = width;
@@ -198,12 +287,10 @@ void Model::checkBorders(QPointF& p, qreal& phi)
 		addImpulse += -x;
 	}
 
-    if (!paintTraceOnly) {
-        impulseSum += addImpulse;
-    }
+	return addImpulse;
 }
 
-void Model::checkAtom(QPointF& p, qreal& phi, QPointF pOld)
+qreal Model::checkAtom(QPointF& p, qreal& phi, QPointF pOld)
 {
 	qreal x = p.x();
 	qreal y = p.y();
@@ -265,89 +352,646 @@ void Model::checkAtom(QPointF& p, qreal& phi, QPointF pOld)
 		x += (1-t)*l*cos(phi);
 		y += (1-t)*l*sin(phi);
 		p = QPointF(x, y);
+		return t;
 	}
+	return -1;
 }
 
 void Model::paint(QPainter *painter, QPaintEvent *event)
 {
-    if (paintTraceOnly) {
-		painter->save();
-		painter->setBrush(traceBrush);
+	QPointF p;
+	QRect rect = event->rect();
+	painter->fillRect(rect, background);
+
+	painter->save();
+
+	if (showBins && binsNumber > 0)
+		paintBins(painter);
+
+	painter->setBrush(atomBrush);
+	for (int i = yBegin; i < rect.height(); i += side) {
+		for (int j = xBegin; j < rect.width(); j += side) {
+			p.ry() = i;
+			p.rx() = j;
+			painter->drawEllipse(p, atomR, atomR);
+		}
+	}
+
+	painter->setBrush(electronBrush);
+	for (int i = 0; i < num; i++) {
+		painter->drawEllipse(positions[i], electronR, electronR);
+	}
+
+	painter->restore();
+}
+
+QVector<QPointF> Model::trace(int elapsed, int steps)
+{
+	QVector<QPointF> points;
+	points.reserve(steps * num);
+	save();
+	setPaintTraceOnly(true);
+	for (int k = 0; k < steps; k++) {
+		step(elapsed);
+		for (int i = 0; i < num; i++)
+			points.append(positions[i]);
+	}
+	setPaintTraceOnly(false);
+	load();
+	return points;
+}
+
+void Model::paintTrace(QPainter *painter, const QVector<QPointF>& points) const
+{
+	painter->save();
+	painter->setBrush(traceBrush);
+	for (int i = 0; i < points.size(); i++)
+		painter->drawEllipse(points[i], 1, 1);
+	painter->restore();
+}
+
+// Every bin is tinted by its occupancy relative to a uniform spread; the
+// selected one is outlined.
+void Model::paintBins(QPainter *painter) const
+{
+	const QVector<int>& counts = occupancy();
+	qreal expected = qreal(num) / binCount();
+	qreal w = qreal(width) / binsNumber;
+	qreal h = qreal(height) / binsNumber;
+	QColor color = binBrush.color();
+	for (int b = 0; b < counts.size(); b++) {
+		QRectF rect((b % binsNumber) * w, (b / binsNumber) * h, w, h);
+		color.setAlpha(expected > 0 ? qBound(0, int(60 * counts[b] / expected), 160) : 0);
+		painter->fillRect(rect, color);
+	}
+	painter->setPen(QPen(binBrush.color().darker(), 2));
+	painter->setBrush(Qt::NoBrush);
+	painter->drawRect(QRectF((binIndex % binsNumber) * w, (binIndex / binsNumber) * h, w, h));
+	painter->setPen(QPen());
+}
+
+void Model::setPaintTraceOnly(bool set)
+{
+	paintTraceOnly = set;
+}
+
+void Model::setBinsNumber(int n)
+{
+	binsNumber = qMax(0, n);
+	int cells = binCount();
+	binCounts.fill(0, cells);
+	binSeries = QVector<CompressedHistory>(cells);
+	binLevels = QVector<HistoryPyramid>(cells);
+	for (int b = 0; b < cells; b++) {
+		if (!historyPrefix.isEmpty())
+			binSeries[b].mapTo(QString("%1-bin%2.hist").arg(historyPrefix).arg(b));
+		binSeries[b].setCapacity(MAX_HISTORY);
+		binLevels[b].setCapacity(MAX_HISTORY);
+	}
+	binIndex = qBound(0, binIndex, qMax(0, cells - 1));
+	binsDirty = true;
+}
+
+void Model::setAngleBinsNumber(int n)
+{
+	angleBins = qMax(0, n);
+	binsDirty = true;
+}
+
+void Model::setBinIndex(int index)
+{
+	binIndex = qBound(0, index, qMax(0, binCount() - 1));
+}
+
+void Model::setShowBins(bool show)
+{
+	showBins = show;
+}
+
+// binOf() and angleOf() run for every particle in every step, so they
+// multiply by scales set by countBins() and avoid fmod() and floor().
+int Model::binOf(const QPointF& p) const
+{
+	int bx = qBound(0, int(p.x() * binScaleX), binsNumber - 1);
+	int by = qBound(0, int(p.y() * binScaleY), binsNumber - 1);
+	return by * binsNumber + bx;
+}
+
+int Model::angleOf(qreal dir) const
+{
+	qreal turns = dir * (0.5 / M_PI);
+	int whole = int(turns);
+	if (turns < whole)
+		whole--;
+	return qMin(int((turns - whole) * angleBins), angleBins - 1);
+}
+
+int Model::cellOf(const QPointF& p, qreal dir) const
+{
+	int cell = binsNumber > 0 ? binOf(p) : 0;
+	if (angleBins > 0)
+		cell = cell * angleBins + angleOf(dir);
+	return cell;
+}
+
+qreal Model::xlogx(int n) const
+{
+	if (n < xlogxTable.size())
+		return xlogxTable[n];
+	return n * log(qreal(n));
+}
+
+// Counts from scratch, when the particles changed outside a step.
+void Model::countBins()
+{
+	int perBin = qMax(1, angleBins);
+	binScaleX = width > 0 ? qreal(binsNumber) / width : 0;
+	binScaleY = height > 0 ? qreal(binsNumber) / height : 0;
+	// the moves would take four logarithms each otherwise
+	int tabulated = isBinned() ? qMin(num, ENTROPY_TABLE) + 1 : 0;
+	if (xlogxTable.size() != tabulated) {
+		xlogxTable.resize(tabulated);
+		for (int n = 0; n < tabulated; n++)
+			xlogxTable[n] = n > 0 ? n * log(qreal(n)) : 0;
+	}
+	cellCounts.fill(0, cellCount());
+	binCounts.fill(0, binCount());
+	angleCounts.fill(0, angleBins);
+	cells.resize(isBinned() ? num : 0);
+	if (isBinned())
 		for (int i = 0; i < num; i++) {
-			painter->drawEllipse(positions[i], 1, 1);
+			cells[i] = cellOf(positions[i], speedDir[i]);
+			cellCounts[cells[i]]++;
+			if (binsNumber > 0)
+				binCounts[cells[i] / perBin]++;
+			if (angleBins > 0)
+				angleCounts[cells[i] % angleBins]++;
+		}
+	resumEntropy();
+	binsDirty = false;
+}
+
+// Only the cells the particles left or entered change, and so only their
+// terms of the entropy sum.
+void Model::applyMoves()
+{
+	int perBin = qMax(1, angleBins);
+	for (int t = 0; t < tiles.size(); t++) {
+		const QVector<CellMove>& moves = tiles[t].moves;
+		for (int k = 0; k < moves.size(); k++) {
+			int from = moves[k].from;
+			int to = moves[k].to;
+			cellSum += xlogx(cellCounts[from] - 1) - xlogx(cellCounts[from])
+				+ xlogx(cellCounts[to] + 1) - xlogx(cellCounts[to]);
+			cellCounts[from]--;
+			cellCounts[to]++;
+			if (binsNumber > 0 && from / perBin != to / perBin) {
+				binCounts[from / perBin]--;
+				binCounts[to / perBin]++;
+			}
+			if (angleBins > 0 && from % angleBins != to % angleBins) {
+				angleCounts[from % angleBins]--;
+				angleCounts[to % angleBins]++;
+			}
 		}
-		painter->restore();
+	}
+	// resum now and then to keep rounding errors from piling up
+	if (++stepsSinceResum >= ENTROPY_RESUM)
+		resumEntropy();
+}
+
+void Model::resumEntropy()
+{
+	cellSum = 0;
+	for (int c = 0; c < cellCounts.size(); c++)
+		cellSum += xlogx(cellCounts[c]);
+	stepsSinceResum = 0;
+}
+
+void Model::updateBins()
+{
+	if (binsDirty)
+		countBins();
+}
+
+qreal Model::isotropy() const
+{
+	const QVector<int>& counts = directions();
+	if (num == 0 || counts.isEmpty())
+		return 0;
+	qreal expected = qreal(num) / counts.size();
+	qreal sum = 0;
+	for (int a = 0; a < counts.size(); a++)
+		sum += (counts[a] - expected) * (counts[a] - expected);
+	return sum / expected;
+}
+
+qreal Model::entropy() const
+{
+	return num > 0 && isBinned() ? log(qreal(num)) - cellSum / num : 0;
+}
+
+int Model::tileOf(const QPointF& p) const
+{
+	qreal tileSide = TILE_CELLS * side;
+	int tx = qBound(0, int(p.x() / tileSide), tilesX - 1);
+	int ty = qBound(0, int(p.y() / tileSide), tilesY - 1);
+	return ty * tilesX + tx;
+}
+
+void Model::permute(const QVector<int>& order)
+{
+	HugeVector<QPointF> newPositions(num);
+	HugeVector<qreal> newSpeedDir(num);
+	for (int i = 0; i < num; i++) {
+		newPositions[i] = positions[order[i]];
+		newSpeedDir[i] = speedDir[order[i]];
+	}
+	positions.swap(newPositions);
+	speedDir.swap(newSpeedDir);
+	HugeVector<qreal> newFlight(num);
+	for (int i = 0; i < num; i++)
+		newFlight[i] = flight[order[i]];
+	flight.swap(newFlight);
+	if (int(cells.size()) == num) {
+		HugeVector<int> newCells(num);
+		for (int i = 0; i < num; i++)
+			newCells[i] = cells[order[i]];
+		cells.swap(newCells);
+	}
+}
+
+int Model::tileCount() const
+{
+	qreal tileSide = TILE_CELLS * side;
+	return qMax(1, int(ceil(width / tileSide))) * qMax(1, int(ceil(height / tileSide)));
+}
+
+// Regroups all particles by tile from scratch (counting sort).
+// Used after the geometry or the particle set has changed.
+void Model::rebuildTiles()
+{
+	qreal tileSide = TILE_CELLS * side;
+	tilesX = qMax(1, int(ceil(width / tileSide)));
+	tilesY = qMax(1, int(ceil(height / tileSide)));
+	int count = tilesX * tilesY;
+
+	QVector<int> owner(num);
+	tileOffsets.fill(0, count + 1);
+	for (int i = 0; i < num; i++) {
+		owner[i] = tileOf(positions[i]);
+		tileOffsets[owner[i] + 1]++;
+	}
+	for (int t = 0; t < count; t++)
+		tileOffsets[t + 1] += tileOffsets[t];
+
+	QVector<int> order(num);
+	QVector<int> fill = tileOffsets;
+	for (int i = 0; i < num; i++)
+		order[fill[owner[i]]++] = i;
+	permute(order);
+
+	tiles.resize(count);
+	for (int t = 0; t < count; t++) {
+		tiles[t].index = t;
+		tiles[t].outbox.clear();
+	}
+	partTiles.clear();
+	tilesDirty = false;
+}
+
+// Moves the particles collected in the tile outboxes to their new tiles.
+// Particles which stayed keep their relative order.
+void Model::migrate()
+{
+	int count = tiles.size();
+	QVector<QVector<int> > inbox(count);
+	bool moved = false;
+	for (int t = 0; t < count; t++) {
+		const QVector<int>& out = tiles[t].outbox;
+		for (int k = 0; k < out.size(); k++)
+			inbox[tileOf(positions[out[k]])].append(out[k]);
+		moved = moved || !out.isEmpty();
+	}
+	if (!moved)
 		return;
+
+	QVector<int> order;
+	order.reserve(num);
+	QVector<int> newOffsets(count + 1);
+	for (int t = 0; t < count; t++) {
+		newOffsets[t] = order.size();
+		const QVector<int>& out = tiles[t].outbox;
+		int k = 0;
+		for (int i = tileOffsets[t]; i < tileOffsets[t + 1]; i++) {
+			if (k < out.size() && out[k] == i)
+				k++;
+			else
+				order.append(i);
+		}
+		order += inbox[t];
+		tiles[t].outbox.clear();
 	}
-	else {
-		QPointF p;
-		QRect rect = event->rect();
-		painter->fillRect(rect, background);
-
-        painter->save();
-
-		painter->setBrush(atomBrush);
-		for (int i = yBegin; i < rect.height(); i += side) {
-			for (int j = xBegin; j < rect.width(); j += side) {
-				p.ry() = i;
-				p.rx() = j;
-				painter->drawEllipse(p, atomR, atomR);
+	newOffsets[count] = num;
+
+	permute(order);
+	tileOffsets = newOffsets;
+}
+
+void Model::stepTile(Tile& tile, qreal s, QPointF *pos, qreal *dir, qreal *flight, int *cell)
+{
+	QPointF newP, curP, dP;
+	int t = tile.index;
+
+	tile.impulse = 0;
+	tile.outbox.clear();
+	// the cell changes are collected on the way and applied to the counts
+	// once all the tiles have moved
+	tile.moves.clear();
+	tile.flights.clear();
+	tile.hits = 0;
+	for (int i = tileOffsets[t]; i < tileOffsets[t + 1]; i++) {
+		dP.rx() = cos(dir[i]) * s;
+		dP.ry() = sin(dir[i]) * s;
+		curP = pos[i];
+		newP = curP + dP;
+		qreal oldDir = dir[i];
+		tile.impulse += checkBorders(newP, dir[i]);
+		qreal hit = checkAtom(newP, dir[i], curP);
+		if (hit >= 0) {
+			// the flight ends where the particle meets the scatterer; the
+			// first one began at a random point, not at a collision
+			if (flight[i] >= 0)
+				tile.flights.append((flight[i] + hit * s) / 100.0);
+			flight[i] = (1 - hit) * s;
+			tile.hits++;
+		}
+		else if (flight[i] >= 0)
+			flight[i] += s;
+		pos[i] = newP;
+		// without spatial bins the cell only changes with the direction
+		if (cell && (binsNumber > 0 || dir[i] != oldDir)) {
+			int c = cellOf(newP, dir[i]);
+			if (c != cell[i]) {
+				CellMove move = { cell[i], c };
+				tile.moves.append(move);
+				cell[i] = c;
 			}
 		}
+		if (tileOf(newP) != t)
+			tile.outbox.append(i);
+	}
+}
 
-		painter->setBrush(electronBrush);
-		for (int i = 0; i < num; i++) {
-			painter->drawEllipse(positions[i], electronR, electronR);
-		}
+void Model::step(int elapsed)
+{
+	prepareStep(1);
+	stepPart(elapsed, 0, 1);
+	finishStep(elapsed);
+}
 
-		painter->restore();
+// The tiles are dealt out to the parts in runs of about equal particle
+// counts; the runs are kept until the number of parts or the tiles change.
+void Model::prepareStep(int parts)
+{
+	if (tilesDirty)
+		rebuildTiles();
+	if (binsDirty && isBinned())
+		countBins();
+	if (partTiles.size() != parts + 1) {
+		partTiles.resize(parts + 1);
+		for (int k = 0; k < parts; k++)
+			partTiles[k] = std::lower_bound(tileOffsets.begin(), tileOffsets.end() - 1,
+					qint64(num) * k / parts) - tileOffsets.begin();
+		partTiles[parts] = tiles.size();
 	}
 }
 
-void Model::setPaintTraceOnly(bool set)
+// The tiles write disjoint ranges of the particle arrays, so the parts
+// need no locking.
+void Model::stepPart(int elapsed, int part, int parts)
 {
-	paintTraceOnly = set;
+	Q_ASSERT(partTiles.size() == parts + 1);
+	qreal s = speed * elapsed / 1000;
+	QPointF *pos = positions.data();
+	qreal *dir = speedDir.data();
+	qreal *fl = flight.data();
+	int *cell = isBinned() ? cells.data() : NULL;
+	for (int t = partTiles[part]; t < partTiles[part + 1]; t++)
+		stepTile(tiles[t], s, pos, dir, fl, cell);
 }
 
-void Model::step(int elapsed)
+void Model::finishStep(int elapsed)
 {
-	QPointF newP, curP, dP;
 	qreal s = speed * elapsed / 1000;
+	if (isBinned())
+		applyMoves();
 
-	for (int i = 0; i < num; i++) {
-		dP.rx() = cos(speedDir[i]) * s;
-		dP.ry() = sin(speedDir[i]) * s;
-		curP = positions[i];
-		newP = curP + dP;
-		checkBorders(newP, speedDir[i]);
-		checkAtom(newP, speedDir[i], curP);
-		positions[i] = newP;
-    }
-    if (!paintTraceOnly)
-        timeFull += s;
+	qreal addImpulse = 0;
+	for (int t = 0; t < tiles.size(); t++)
+		addImpulse += tiles[t].impulse;
+	migrate();
 
-    if (time.size() >= MAX_HISTORY) {
-        time.pop_front();
-        impulses.pop_front();
+    if (!paintTraceOnly) {
+        for (int t = 0; t < tiles.size(); t++) {
+            const QVector<qreal>& ended = tiles[t].flights;
+            for (int k = 0; k < ended.size(); k++) {
+                flights.add(ended[k]);
+                flightSum += ended[k];
+            }
+            collisions += tiles[t].hits;
+        }
+        impulseSum += addImpulse;
+        timeFull += s;
+        // in the units of the pressure, impulse per unit of t
+        if (s > 0)
+            correlator.add(addImpulse / (s / 100.0));
     }
+}
 
-	if ((time.empty() || (time.back() + measurePeriod <= timeFull)) && time.size() < MAX_HISTORY) {
-        time.push_back(timeFull/100.0);
-        impulses.push_back(impulseSum);
-    }
+// Called by the ensemble whenever it takes a sample at time t; returns the
+// pressure recorded, averaged since the start or, when windowed, since the
+// previous sample. Once MAX_HISTORY samples are stored the oldest ones are
+// overwritten.
+qreal Model::record(qreal t, bool windowed)
+{
+	updateBins();
+	interval = t > markTime ? (impulseSum - markImpulse) / (t - markTime) : impulseSum / t;
+	qreal pressure = windowed ? interval : impulseSum / t;
+	markTime = t;
+	markImpulse = impulseSum;
+
+	qreal averaged = average.add(pressure);
+	sampled.add(pressure);
+	pressures.append(pressure);
+	pressureLevels.add(pressure);
+	timeAveraged.append(averaged);
+	averagedLevels.add(averaged);
+	qreal error = averageError();
+	averagedErrors.append(error);
+	errorLevels.add(error);
+	if (isBinned()) {
+		qreal s = entropy();
+		entropies.append(s);
+		entropyLevels.add(s);
+	}
+	if (angleBins > 0) {
+		qreal chi2 = isotropy();
+		isotropies.append(chi2);
+		isotropyLevels.add(chi2);
+	}
+	if (binsNumber > 0 && num > 0) {
+		const QVector<int>& counts = occupancy();
+		for (int b = 0; b < counts.size(); b++) {
+			qreal fraction = qreal(counts[b]) / num;
+			binSeries[b].append(fraction);
+			binLevels[b].add(fraction);
+		}
+	}
+	return pressure;
 }
 
+qreal Model::correlationTime() const
+{
+	if (correlator.count() == 0)
+		return 0;
+	return correlator.integratedTime() * timeFull / correlator.count() / 100.0;
+}
+
+// The time average spans some of the samples, which stand for about as
+// many steps each.
+qreal Model::averageError() const
+{
+	return sampled.standardError(average.span());
+}
+
+// The autocorrelation is listed at one lag per level of the correlator,
+// so about one per doubling of the lag.
+QString Model::describeCorrelation() const
+{
+	QString text = QString("correlation time %1, time average %2 +- %3")
+		.arg(correlationTime()).arg(average.value()).arg(averageError());
+	QVector<qreal> lags, rho;
+	correlator.autocorrelation(lags, rho);
+	qreal step = correlator.count() > 0 ? timeFull / correlator.count() / 100.0 : 0;
+	if (!lags.isEmpty())
+		text += "\nautocorrelation:";
+	for (int i = 1; i < lags.size(); i += MultiTauCorrelator::CHANNELS / MultiTauCorrelator::AVERAGE)
+		text += QString(" %1:%2").arg(lags[i] * step, 0, 'g', 3).arg(rho[i], 0, 'f', 2);
+	return text;
+}
+
+void Model::mapHistory(const QString& prefix)
+{
+	pressures.mapTo(prefix + "-pressure.hist");
+	timeAveraged.mapTo(prefix + "-averaged.hist");
+	averagedErrors.mapTo(prefix + "-errors.hist");
+	entropies.mapTo(prefix + "-entropy.hist");
+	isotropies.mapTo(prefix + "-isotropy.hist");
+	historyPrefix = prefix;
+	for (int b = 0; b < binSeries.size(); b++)
+		binSeries[b].mapTo(QString("%1-bin%2.hist").arg(prefix).arg(b));
+	clear();
+}
+
+int Model::unmappedHistories() const
+{
+	if (historyPrefix.isEmpty())
+		return 0;
+	const CompressedHistory *histories[] = { &pressures, &timeAveraged, &averagedErrors, &entropies, &isotropies };
+	int count = 0;
+	for (int k = 0; k < 5; k++)
+		count += histories[k]->isMapped() ? 0 : 1;
+	for (int b = 0; b < binSeries.size(); b++)
+		count += binSeries[b].isMapped() ? 0 : 1;
+	return count;
+}
+
+void Model::shrinkHistory(int samples)
+{
+	pressures.shrink(samples);
+	timeAveraged.shrink(samples);
+	pressureLevels.shrink(samples);
+	averagedLevels.shrink(samples);
+	averagedErrors.shrink(samples);
+	errorLevels.shrink(samples);
+	entropies.shrink(samples);
+	entropyLevels.shrink(samples);
+	isotropies.shrink(samples);
+	isotropyLevels.shrink(samples);
+	for (int b = 0; b < binSeries.size(); b++) {
+		binSeries[b].shrink(samples);
+		binLevels[b].shrink(samples);
+	}
+}
+
+qint64 Model::historyBytes() const
+{
+	qint64 bytes = pressures.bytes() + timeAveraged.bytes() + averagedErrors.bytes()
+		+ pressureLevels.bytes() + averagedLevels.bytes() + errorLevels.bytes()
+		+ entropies.bytes() + entropyLevels.bytes() + isotropies.bytes() + isotropyLevels.bytes();
+	for (int b = 0; b < binSeries.size(); b++)
+		bytes += binSeries[b].bytes() + binLevels[b].bytes();
+	return bytes;
+}
 
 void Model::save()
 {
 	positions_save = positions;
 	speedDir_save = speedDir;
+	flight_save = flight;
 }
 
 void Model::load()
 {
 	positions = positions_save;
 	speedDir = speedDir_save;
+	flight = flight_save;
+	tilesDirty = true;
+	binsDirty = true;
+}
+
+void Model::saveState(QDataStream& out) const
+{
+	out << side << atomR << electronR << speed << width << height;
+	out << timeFull << impulseSum << num;
+	for (int i = 0; i < num; i++)
+		out << positions[i] << speedDir[i] << flight[i];
+	out << collisions << flightSum << flights.bins();
+	for (int b = 0; b < flights.bins(); b++)
+		out << flights.count(b);
+	// so that the error bars go on where they were
+	out << markTime << markImpulse;
+	average.saveState(out);
+	correlator.saveState(out);
+	sampled.saveState(out);
+	detector.saveState(out);
+}
+
+void Model::loadState(QDataStream& in)
+{
+	int w, h;
+	in >> side >> atomR >> electronR >> speed >> w >> h;
+	in >> timeFull >> impulseSum >> num;
+	positions.resize(num);
+	speedDir.resize(num);
+	flight.resize(num);
+	for (int i = 0; i < num; i++)
+		in >> positions[i] >> speedDir[i] >> flight[i];
+	setDim(w, h);
+	// after setDim(), which restarts the free flights
+	int bins;
+	in >> collisions >> flightSum >> bins;
+	for (int b = 0; b < bins; b++) {
+		qint64 count;
+		in >> count;
+		flights.add(flights.center(b), count);
+	}
+	in >> markTime >> markImpulse;
+	average.loadState(in);
+	correlator.loadState(in);
+	sampled.loadState(in);
+	detector.loadState(in);
 }
 
 Model::~Model() {
@@ -6,50 +6,199 @@
 #include <QPen>
 #include <QPainter>
 #include <QPaintEvent>
+#include <QDataStream>
+#include <random>
+
+#include "hugepages.h"
+#include "ringbuffer.h"
+#include "compressedhistory.h"
+#include "averages.h"
+#include "correlator.h"
+#include "equilibrium.h"
+#include "pyramid.h"
+#include "statistics.h"
 
 class Model
 {
 public:
     Model();
-    Model(const Model&);
+    // The settings of copied, with as many particles placed by a generator
+    // of its own seeded with seed.
+    Model(const Model& copied, quint32 seed = 1);
 
     ~Model();
 
 public:
 	void step(int elapsed);
+	// step() split for members stepped by several workers: after
+	// prepareStep(parts), stepPart() runs once for every part, each part on
+	// its own worker, and finishStep() collects them once all are done.
+	void prepareStep(int parts);
+	void stepPart(int elapsed, int part, int parts);
+	void finishStep(int elapsed);
+	// Tiles of the field, the most parts a step can be split into.
+	int tileCount() const;
+	// Whether the member is big enough to be worth splitting.
+	bool isSplittable() const { return num >= PARALLEL_THRESHOLD && tileCount() > 1; }
+	qreal record(qreal t, bool windowed);
 	void add(int x, int y, qreal angle);
 	void clear();
 
 	void paint(QPainter *painter, QPaintEvent *event);
+	// Positions of the particles after each of the next steps of elapsed
+	// ms, leaving the model as it was; to be run by the owning worker.
+	QVector<QPointF> trace(int elapsed, int steps);
+	void paintTrace(QPainter *painter, const QVector<QPointF>& points) const;
 	void setDim(int w, int h);
 
 	int getNumber() const;
-    QVector<qreal> getTime() const;
-    QVector<qreal> getImpulses() const;
+	CompressedView pressuresView() const { return pressures.view(); }
+	CompressedView timeAveragedView() const { return timeAveraged.view(); }
+	// Standard error of every time-averaged sample.
+	CompressedView averagedErrorsView() const { return averagedErrors.view(); }
 	int getWidth() const { return width; }
 	int getHeight() const { return height; }
 
+	// New particles are placed by the member's own generator.
 	void setNumber(int newNum);
+	void setSeed(quint32 seed);
 	void setSide(int);
 	void setSpeed(qreal);
 	void setAtomR(qreal);
 	void setElectronR(qreal);
-	void setBinsNumber(int);
-	void setBinIndex(int);
 	void setPaintTraceOnly(bool);
 
 	void save();
 	void load();
 
+	// Physical state (geometry, particles, accumulated impulse) and the
+	// running estimators (time average, correlators, equilibrium detector,
+	// free flights) without the measurement history, used for checkpoints.
+	void saveState(QDataStream& out) const;
+	void loadState(QDataStream& in);
+
+	// Spatial occupancy: the field is split into n x n bins (none when 0)
+	// kept up to date by the step kernel. The fraction of the particles in
+	// every bin is recorded with each sample (clears the bin histories).
+	void setBinsNumber(int n);
+	// The bin outlined by the overlay and plotted by the GUI.
+	void setBinIndex(int);
+	// Paints the occupancy of the bins under the particles.
 	void setShowBins(bool);
+	int getBinsNumber() const { return binsNumber; }
+	int getBinIndex() const { return binIndex; }
+	int binCount() const { return binsNumber * binsNumber; }
+	// Recounts the bins if the particles changed outside a step; the counts
+	// below are read as they were last brought up to date.
+	void updateBins();
+	// Particles in every bin now.
+	const QVector<int>& occupancy() const { return binCounts; }
+	CompressedView binView(int bin) const { return binSeries[bin].view(); }
+
+	// The directions are split into n bins as well (none when 0). The
+	// spatial and the direction bins make the cells of the phase space.
+	void setAngleBinsNumber(int n);
+	int getAngleBinsNumber() const { return angleBins; }
+	bool isBinned() const { return binsNumber > 0 || angleBins > 0; }
+	int cellCount() const { return isBinned() ? qMax(1, binCount()) * qMax(1, angleBins) : 0; }
+	// Particles in every direction bin now, the first one starting at 0.
+	const QVector<int>& directions() const { return angleCounts; }
+	// Chi-square of the direction bins against isotropy, with
+	// getAngleBinsNumber() - 1 degrees of freedom; recorded with each
+	// sample while the directions are binned.
+	qreal isotropy() const;
+	CompressedView isotropiesView() const { return isotropies.view(); }
+	// Coarse-grained entropy -sum p ln p over the phase-space cells, at
+	// most ln cellCount(); recorded with each sample while binned.
+	qreal entropy() const;
+	CompressedView entropiesView() const { return entropies.view(); }
+
+	// Free flights between two scatterer collisions, in units of t, over
+	// [0, the longer side of the field]; longer ones fall in the last bin.
+	// The flight of a particle from its start to its first collision is
+	// left out. Counted since the last clear(), like the rates below.
+	const Histogram& flightHistogram() const { return flights; }
+	qint64 getCollisions() const { return collisions; }
+	// Mean of the flights in flightHistogram().
+	qreal meanFreeTime() const;
+	// The particles move 100 units of length per unit of t.
+	qreal meanFreePath() const { return meanFreeTime() * 100; }
+	// Scatterer collisions per particle per unit of t.
+	qreal collisionFrequency() const;
+	QString describeCollisions() const;
+
+	// Moves the histories to files named prefix-*.hist (clears them).
+	void mapHistory(const QString& prefix);
+	// Histories which should be in files but stayed in RAM, for instance
+	// past vm.max_map_count.
+	int unmappedHistories() const;
+	// Keeps at most samples of full resolution; older ones are left to the
+	// coarse levels.
+	void shrinkHistory(int samples);
+	// Bytes of RAM held by the histories.
+	qint64 historyBytes() const;
+
+	// Integrated autocorrelation time of the impulse rate, in units of t.
+	qreal correlationTime() const;
+	// Standard error of the time average of the pressure samples, from
+	// their own autocorrelation.
+	qreal averageError() const;
+	// Mean of every pressure sample so far, whatever the mode of the time
+	// average shown; the ergodicity is measured on it.
+	qreal cumulativeAverage() const { return sampled.mean(); }
+	// Pressure over the interval before the last sample, whatever the rate
+	// recorded; the statistical detectors look at it.
+	qreal intervalPressure() const { return interval; }
+	QString describeCorrelation() const;
 
 	static const qreal timeStep;
 	static const qreal measurePeriod;
 	static const int MAX_HISTORY;
+	static const int TILE_CELLS;
+	static const int PARALLEL_THRESHOLD;
+	static const int ENTROPY_RESUM;
+	static const int ENTROPY_TABLE;
+	static const int FLIGHT_BINS;
 
 public:
-	void checkBorders(QPointF& p, qreal& phi);
-	void checkAtom(QPointF& p, qreal& phi, QPointF pOld);
+	// A particle which went over to another phase-space cell.
+	struct CellMove {
+		int from;
+		int to;
+	};
+
+	// The field is split into square tiles of TILE_CELLS x TILE_CELLS
+	// scatterer cells; the particle arrays are kept grouped by tile so that
+	// every tile is stepped over a contiguous range. Each tile belongs to
+	// one part of the step, so a split member has the same worker step it
+	// every time.
+	struct Tile {
+		int index;
+		qreal impulse;		// wall impulse collected during the step
+		QVector<int> outbox;	// particles which left the tile during the step
+		QVector<CellMove> moves;	// cell changes during the step
+		QVector<qreal> flights;		// free flights ended during the step
+		int hits;			// scatterer collisions during the step
+	};
+
+	qreal checkBorders(QPointF& p, qreal& phi);
+	// Returns the part of the step before the collision, -1 for none.
+	qreal checkAtom(QPointF& p, qreal& phi, QPointF pOld);
+
+	int tileOf(const QPointF& p) const;
+	int binOf(const QPointF& p) const;
+	int angleOf(qreal dir) const;
+	int cellOf(const QPointF& p, qreal dir) const;
+	void countBins();
+	void applyMoves();
+	void resumEntropy();
+	void resetFlights();
+	qreal xlogx(int n) const;
+	void paintBins(QPainter *painter) const;
+	void stepTile(Tile& tile, qreal s, QPointF *pos, qreal *dir, qreal *flight, int *cell);
+	void rebuildTiles();
+	void migrate();
+	void permute(const QVector<int>& order);
 
 	int width;
 	int height;
@@ -69,17 +218,73 @@ public:
 	qreal speed;
 
 	int num;
-	QVector<qreal> speedDir;
-	QVector<QPointF> positions;
+	std::mt19937 generator;
+	HugeVector<qreal> speedDir;
+	HugeVector<QPointF> positions;
+
+	// length flown since the last scatterer collision, -1 before the first
+	HugeVector<qreal> flight;
+
+	HugeVector<qreal> speedDir_save;
+	HugeVector<QPointF> positions_save;
+	HugeVector<qreal> flight_save;
+
+	int tilesX, tilesY;
+	QVector<int> tileOffsets;	// first particle of every tile, plus the end
+	QVector<Tile> tiles;
+	QVector<int> partTiles;		// first tile of every part, plus the end
+	bool tilesDirty;
 
-	QVector<qreal> speedDir_save;
-	QVector<QPointF> positions_save;
+	int binsNumber;
+	int angleBins;
+	int binIndex;
+	bool showBins;
+	// cell of every particle and the counts, updated with the moves of the
+	// tiles at the end of every step; cell c is spatial bin c / angle bins
+	HugeVector<int> cells;
+	QVector<int> cellCounts;
+	QVector<int> binCounts;
+	QVector<int> angleCounts;
+	qreal binScaleX, binScaleY;	// bins per unit of length
+	qreal cellSum;			// sum of n ln n over the cells
+	QVector<qreal> xlogxTable;	// n ln n up to ENTROPY_TABLE
+	int stepsSinceResum;
+	bool binsDirty;			// the particles changed outside a step
+	// fraction of the particles in every bin at every sample
+	QVector<CompressedHistory> binSeries;
+	QVector<HistoryPyramid> binLevels;
+	CompressedHistory entropies;
+	HistoryPyramid entropyLevels;
+	CompressedHistory isotropies;
+	HistoryPyramid isotropyLevels;
+	// free flights merged from the tiles at the end of every step
+	Histogram flights;
+	qint64 collisions;
+	qreal flightSum;
+	QString historyPrefix;		// of mapHistory(), empty when in RAM
 
     bool paintTraceOnly;
 
     qreal timeFull, impulseSum;
-    QVector<qreal> time;		// values of time
-	QVector<qreal> impulses;	// overall sum of collision impulses
+	// pressure sampled at the times of Ensemble::time
+	CompressedHistory pressures;
+	HistoryPyramid pressureLevels;
+	// time and impulse sum at the previous sample
+	qreal markTime, markImpulse;
+	qreal interval;
+	// time average of the pressure, updated as every sample is recorded
+	TimeAverage average;
+	CompressedHistory timeAveraged;
+	HistoryPyramid averagedLevels;
+	// impulse rate of every step
+	MultiTauCorrelator correlator;
+	// pressure of every sample, as the time average sees them, and the
+	// error of the time average at every sample
+	MultiTauCorrelator sampled;
+	CompressedHistory averagedErrors;
+	HistoryPyramid errorLevels;
+	// fed every sample by the ensemble, against the ensemble average
+	EquilibriumDetector detector;
 };
 
 #endif
@@ -0,0 +1,239 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <QtGlobal>
+#include <QVector>
+
+#include "ringbuffer.h"
+
+// Minimum, maximum and mean of a run of samples.
+struct HistoryBucket
+{
+	qreal min;
+	qreal max;
+	qreal sum;
+	int count;
+
+	HistoryBucket() : min(0), max(0), sum(0), count(0) {}
+	explicit HistoryBucket(qreal x) : min(x), max(x), sum(x), count(1) {}
+
+	void add(qreal x)
+	{
+		if (count == 0 || x < min)
+			min = x;
+		if (count == 0 || x > max)
+			max = x;
+		sum += x;
+		count++;
+	}
+
+	qreal mean() const { return count > 0 ? sum / count : 0; }
+};
+
+// Coarser copies of a history of qreal samples for plotting at screen
+// resolution. Level k summarises runs of FANOUT^(k+2) samples; runs any
+// shorter would cost about as much as the history itself. The first level
+// covers as many samples as the history and every coarser level keeps the
+// same number of buckets, 1/COARSE of the history, so each reaches FANOUT
+// times further back: samples the history dropped live on at ever coarser
+// resolution. Samples are numbered from the first one added since clear(),
+// as Ensemble::samplesTaken() does.
+class HistoryPyramid
+{
+public:
+	static const int FANOUT = 8;
+	static const int COARSE = 64;
+
+	HistoryPyramid() : added(0) {}
+
+	void setCapacity(int samples)
+	{
+		levels.clear();
+		for (qint64 span = FANOUT * FANOUT; span <= samples; span *= FANOUT) {
+			Level level;
+			level.span = span;
+			level.done = 0;
+			level.buckets.setCapacity(bucketsFor(span, samples));
+			levels.append(level);
+		}
+		clear();
+	}
+
+	// Follows the history down to a smaller capacity, keeping the newest
+	// buckets.
+	void shrink(int samples)
+	{
+		for (int k = 0; k < levels.size(); k++)
+			levels[k].buckets.shrink(bucketsFor(levels[k].span, samples));
+	}
+
+	void clear()
+	{
+		added = 0;
+		for (int k = 0; k < levels.size(); k++) {
+			levels[k].buckets.clear();
+			levels[k].partial = HistoryBucket();
+			levels[k].done = 0;
+		}
+	}
+
+	// O(number of levels) per sample.
+	void add(qreal x)
+	{
+		added++;
+		for (int k = 0; k < levels.size(); k++) {
+			Level& level = levels[k];
+			level.partial.add(x);
+			if (level.partial.count == level.span) {
+				level.buckets.append(pack(level.partial));
+				level.partial = HistoryBucket();
+				level.done++;
+			}
+		}
+	}
+
+	qint64 size() const { return added; }
+
+	// The oldest sample some level still covers.
+	qint64 oldest() const
+	{
+		qint64 first = added;
+		for (int k = 0; k < levels.size(); k++)
+			first = qMin(first, (levels[k].done - levels[k].buckets.size()) * levels[k].span);
+		return first;
+	}
+
+	qint64 bytes() const
+	{
+		qint64 total = 0;
+		for (int k = 0; k < levels.size(); k++)
+			total += levels[k].buckets.bytes();
+		return total;
+	}
+
+	// Summarises samples [from, to) in roughly points buckets, at least one
+	// raw sample each; samples older than a level keeps come from the
+	// coarser ones. raw is the history mirrored by the pyramid and value
+	// reads a qreal out of one of its elements. Returns about FANOUT *
+	// points buckets at most, oldest first.
+	template <typename View, typename Value>
+	QVector<HistoryBucket> query(const View& raw, qint64 from, qint64 to, int points, Value value) const
+	{
+		QVector<HistoryBucket> result;
+		qint64 rawFirst = added - raw.size();
+		from = qMax(from, qMin(rawFirst, oldest()));
+		to = qMin(to, added);
+		if (from >= to || points <= 0)
+			return result;
+
+		// the coarsest level still giving at least points buckets
+		int k = -1;
+		while (k + 1 < levels.size() && levels[k + 1].span * points <= to - from)
+			k++;
+
+		for (qint64 pos = from; pos < to; ) {
+			int l = levelFor(pos, k, rawFirst);
+			if (l < 0) {
+				if (pos >= rawFirst)
+					result.append(HistoryBucket(value(raw[int(pos - rawFirst)])));
+				pos++;
+				continue;
+			}
+			const Level& level = levels[l];
+			qint64 j = pos / level.span;
+			qint64 stored = level.done - level.buckets.size();
+			result.append(j < level.done ? unpack(level.buckets[int(j - stored)], level.span)
+				: level.partial);
+			pos = (j + 1) * level.span;
+		}
+		return result;
+	}
+
+	template <typename View>
+	QVector<HistoryBucket> query(const View& raw, qint64 from, qint64 to, int points) const
+	{
+		return query(raw, from, to, points, [](qreal x) { return x; });
+	}
+
+private:
+	// A completed bucket as the levels keep it: single precision is plenty
+	// at screen resolution, and the count is the span of the level.
+	struct Packed
+	{
+		float min;
+		float max;
+		float mean;
+	};
+
+	struct Level
+	{
+		qint64 span;	// samples per bucket
+		qint64 done;	// buckets completed since clear()
+		RingBuffer<Packed> buckets;
+		HistoryBucket partial;
+	};
+
+	static Packed pack(const HistoryBucket& b)
+	{
+		Packed p = { float(b.min), float(b.max), float(b.mean()) };
+		return p;
+	}
+
+	static HistoryBucket unpack(const Packed& p, qint64 span)
+	{
+		HistoryBucket b;
+		b.min = p.min;
+		b.max = p.max;
+		b.sum = p.mean * qreal(span);
+		b.count = int(span);
+		return b;
+	}
+
+	static int bucketsFor(qint64 span, int samples)
+	{
+		return int(qMax<qint64>(samples / span, samples / COARSE)) + 1;
+	}
+
+	bool covers(int l, qint64 pos, qint64 rawFirst) const
+	{
+		if (l < 0)
+			return pos >= rawFirst;
+		const Level& level = levels[l];
+		qint64 j = pos / level.span;
+		return j >= level.done - level.buckets.size() && (j < level.done || level.partial.count > 0);
+	}
+
+	// The finest level from k on holding pos, or a finer one if none does.
+	int levelFor(qint64 pos, int k, qint64 rawFirst) const
+	{
+		for (int l = k; l < levels.size(); l++)
+			if (covers(l, pos, rawFirst))
+				return l;
+		for (int l = k - 1; l >= 0; l--)
+			if (covers(l, pos, rawFirst))
+				return l;
+		return -1;
+	}
+
+	QVector<Level> levels;
+	qint64 added;
+};
+
+// The newest n elements of a history view, to line up histories of
+// different lengths sample by sample.
+template <typename View>
+class HistoryTail
+{
+public:
+	HistoryTail(const View& view, int n) : view(view), offset(view.size() - n), n(n) {}
+
+	int size() const { return n; }
+	typename View::value_type operator[](int i) const { return view[offset + i]; }
+
+private:
+	const View& view;
+	int offset;
+	int n;
+};
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <QAtomicInt>
+#include <algorithm>
+#include <climits>
+
+#include "hugepages.h"
+#include "historyfile.h"
+
+// A history as at most two contiguous runs, oldest first.
+template <typename T>
+struct HistorySegments
+{
+	const T *first;
+	int firstSize;
+	const T *second;
+	int secondSize;
+};
+
+// Read-only view of a RingBuffer which does not copy the data, valid only
+// until the buffer next changes; the GUI takes its views between two steps
+// of the ensemble. The buffer counts the views alive so that debug builds
+// assert when it is changed under one.
+template <typename T>
+class HistoryView
+{
+public:
+	typedef T value_type;
+
+	HistoryView() : pins(NULL)
+	{
+		s.first = s.second = NULL;
+		s.firstSize = s.secondSize = 0;
+	}
+
+	HistoryView(const HistorySegments<T>& segments, QAtomicInt *pins) : s(segments), pins(pins)
+	{
+		pins->ref();
+	}
+
+	HistoryView(const HistoryView& other) : s(other.s), pins(other.pins)
+	{
+		if (pins)
+			pins->ref();
+	}
+
+	HistoryView& operator=(const HistoryView& other)
+	{
+		if (other.pins)
+			other.pins->ref();
+		if (pins)
+			pins->deref();
+		s = other.s;
+		pins = other.pins;
+		return *this;
+	}
+
+	~HistoryView()
+	{
+		if (pins)
+			pins->deref();
+	}
+
+	int size() const { return s.firstSize + s.secondSize; }
+	bool isEmpty() const { return size() == 0; }
+
+	const T& operator[](int i) const
+	{
+		return i < s.firstSize ? s.first[i] : s.second[i - s.firstSize];
+	}
+
+	const T& first() const { return (*this)[0]; }
+	const T& last() const { return (*this)[size() - 1]; }
+
+	const HistorySegments<T>& segments() const { return s; }
+
+private:
+	HistorySegments<T> s;
+	QAtomicInt *pins;
+};
+
+// Fixed-capacity history with O(1) append: once full, an append drops the
+// oldest evictionUnit() elements (1 by default) and overwrites the first of
+// them. The storage grows geometrically up to the capacity, so a large
+// capacity costs nothing until it is used.
+// Elements are indexed from the oldest (0) to the newest (size() - 1).
+// With mapTo() the elements go to an append-only file instead and nothing is
+// overwritten; copies of such a buffer are held in RAM.
+template <typename T>
+class RingBuffer
+{
+public:
+	typedef HistorySegments<T> Segments;
+
+	explicit RingBuffer(int capacity = 0) : head(0), count(0), cap(capacity), unit(1), file(NULL), pins(0) {}
+	RingBuffer(const RingBuffer& other) : head(0), count(0), cap(0), unit(1), file(NULL), pins(0) { copy(other); }
+	~RingBuffer() { delete file; }
+
+	RingBuffer& operator=(const RingBuffer& other)
+	{
+		Q_ASSERT(pins.loadAcquire() == 0);
+		if (this != &other)
+			copy(other);
+		return *this;
+	}
+
+	// Moves the buffer (emptied) to the file at path; stays in RAM when the
+	// file cannot be mapped. T must be copyable as raw bytes.
+	bool mapTo(const QString& path)
+	{
+		Q_ASSERT(pins.loadAcquire() == 0);
+		HistoryFile *mapped = new HistoryFile;
+		if (!mapped->open(path, sizeof(T))) {
+			delete mapped;
+			return false;
+		}
+		delete file;
+		file = mapped;
+		clear();
+		return true;
+	}
+
+	bool isMapped() const { return file != NULL; }
+
+	int size() const { return count; }
+	int capacity() const { return file ? INT_MAX : cap; }
+	bool isEmpty() const { return count == 0; }
+	bool isFull() const { return !file && count == cap; }
+
+	void setCapacity(int capacity)
+	{
+		cap = capacity;
+		clear();
+	}
+
+	// Elements dropped at once when full; set it to CompressedHistory::BLOCK
+	// to keep sample i of a compressed history at index i here as well.
+	void setEvictionUnit(int n) { unit = qMax(1, n); }
+	int evictionUnit() const { return unit; }
+
+	// Lowers the capacity keeping the newest elements, dropped in whole
+	// eviction units. Buffers in files are not limited.
+	void shrink(int capacity)
+	{
+		Q_ASSERT(pins.loadAcquire() == 0);
+		if (file || capacity >= cap)
+			return;
+		int keep = count;
+		if (count > capacity)
+			keep -= (count - capacity + unit - 1) / unit * unit;
+		keep = qMax(0, keep);
+		HugeVector<T> kept;
+		kept.reserve(keep);
+		for (int i = count - keep; i < count; i++)
+			kept.push_back((*this)[i]);
+		data.swap(kept);
+		head = 0;
+		count = keep;
+		cap = capacity;
+	}
+
+	// Bytes of RAM held; for a file, at most its resident tail.
+	qint64 bytes() const
+	{
+		if (file)
+			return qMin<qint64>(qint64(count) * sizeof(T), 2 * HistoryFile::RESIDENT_BYTES);
+		return qint64(data.capacity()) * sizeof(T);
+	}
+
+	void clear()
+	{
+		Q_ASSERT(pins.loadAcquire() == 0);
+		HugeVector<T>().swap(data);
+		if (file)
+			file->truncate();
+		head = 0;
+		count = 0;
+	}
+
+	void append(const T& value)
+	{
+		Q_ASSERT(pins.loadAcquire() == 0);
+		if (file) {
+			if (count < INT_MAX && file->append(&value))
+				count++;
+			return;
+		}
+		if (cap <= 0)
+			return;
+		if (count == cap) {
+			int dropped = qMin(unit, count);
+			head = (head + dropped) % cap;
+			count -= dropped;
+		}
+		if (int(data.size()) < cap) {
+			if (data.size() == data.capacity())
+				data.reserve(qMin(cap, qMax(16, 2 * count)));
+			data.push_back(value);
+		}
+		else {
+			int k = head + count;
+			data[k < cap ? k : k - cap] = value;
+		}
+		count++;
+	}
+
+	const T& operator[](int i) const
+	{
+		int k = head + i;
+		return base()[k < cap || file ? k : k - cap];
+	}
+
+	const T& first() const { return (*this)[0]; }
+	const T& last() const { return (*this)[count - 1]; }
+
+	Segments segments() const
+	{
+		Segments s;
+		s.first = base() + head;
+		s.firstSize = file ? count : qMin(count, cap - head);
+		s.second = base();
+		s.secondSize = count - s.firstSize;
+		return s;
+	}
+
+	HistoryView<T> view() const
+	{
+		return HistoryView<T>(segments(), &pins);
+	}
+
+	QVector<T> toVector() const
+	{
+		Segments s = segments();
+		QVector<T> result(count);
+		std::copy(s.first, s.first + s.firstSize, result.begin());
+		std::copy(s.second, s.second + s.secondSize, result.begin() + s.firstSize);
+		return result;
+	}
+
+private:
+	const T *base() const
+	{
+		return file ? reinterpret_cast<const T*>(file->records()) : data.data();
+	}
+
+	void copy(const RingBuffer& other)
+	{
+		delete file;
+		file = NULL;
+		if (other.file) {
+			// unrolled into RAM, holding everything the file has
+			Segments s = other.segments();
+			data.assign(s.first, s.first + s.firstSize);
+			head = 0;
+			count = other.count;
+			cap = qMax(other.cap, count);
+		}
+		else {
+			data = other.data;
+			head = other.head;
+			count = other.count;
+			cap = other.cap;
+		}
+		unit = other.unit;
+	}
+
+	HugeVector<T> data;
+	int head;	// position of the oldest element once the buffer wrapped
+	int count;
+	int cap;
+	int unit;	// elements dropped at once when full
+	HistoryFile *file;	// backing file, or NULL when held in RAM
+	mutable QAtomicInt pins;	// live views
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QDataStream>
+
+// Decides when the ensemble takes a sample. Times are in the units of
+// Model::timeFull; a sample is due once interval has passed since the last.
+//
+// Rate selects what a sample holds: the pressure averaged since the start
+// of the run (Cumulative) or over the interval since the previous sample
+// (Windowed). The ensemble starts with defaultRate().
+//
+// For long runs the interval may be multiplied by decimateFactor every
+// decimateAfter samples, so the history grows only logarithmically with
+// the run time. Decimation is off by default (decimateAfter = 0): the time
+// averages, the equilibrium detectors and the error estimates weigh every
+// sample alike, which over-weights the early samples once the interval
+// grows. The history budget bounds the memory of long runs instead.
+class MeasurementScheduler
+{
+public:
+	enum Rate { Cumulative, Windowed };
+
+	MeasurementScheduler(qreal interval = 20.0)
+		: rate(Cumulative), baseInterval(interval), decimateAfter(0), decimateFactor(2)
+	{
+		clear();
+	}
+
+	void setInterval(qreal value)
+	{
+		baseInterval = value;
+		clear();
+	}
+
+	void setRate(Rate value) { rate = value; }
+	static QString rateName(Rate r) { return r == Windowed ? "windowed" : "cumulative"; }
+	// False when name is none of the rateName()s.
+	static bool rateFromName(const QString& name, Rate *r)
+	{
+		for (int i = Cumulative; i <= Windowed; i++)
+			if (name == rateName(Rate(i))) {
+				*r = Rate(i);
+				return true;
+			}
+		return false;
+	}
+	// The rate named by LORENTZ_RATE, Cumulative when unset or unknown.
+	static Rate defaultRate()
+	{
+		Rate r;
+		return rateFromName(QString::fromLocal8Bit(qgetenv("LORENTZ_RATE")), &r) ? r : Cumulative;
+	}
+
+	void setDecimation(int after, int factor)
+	{
+		decimateAfter = after;
+		decimateFactor = qMax(1, factor);
+		clear();
+	}
+
+	Rate getRate() const { return rate; }
+	qreal getInterval() const { return interval; }
+	int getDecimateAfter() const { return decimateAfter; }
+	int getDecimateFactor() const { return decimateFactor; }
+
+	void clear()
+	{
+		interval = baseInterval;
+		last = 0;
+		sinceDecimation = 0;
+		started = false;
+	}
+
+	bool due(qreal time) const
+	{
+		return !started || last + interval <= time;
+	}
+
+	// Where the sampling is, for checkpoints; the settings are left out.
+	void saveState(QDataStream& out) const
+	{
+		out << interval << last << sinceDecimation << started;
+	}
+
+	void loadState(QDataStream& in)
+	{
+		in >> interval >> last >> sinceDecimation >> started;
+	}
+
+	// Notes a sample taken at time.
+	void taken(qreal time)
+	{
+		started = true;
+		last = time;
+		if (decimateAfter > 0 && ++sinceDecimation >= decimateAfter) {
+			interval *= decimateFactor;
+			sinceDecimation = 0;
+		}
+	}
+
+private:
+	Rate rate;
+	qreal baseInterval;
+	int decimateAfter;
+	int decimateFactor;
+
+	qreal interval;
+	qreal last;
+	int sinceDecimation;
+	bool started;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <QtGlobal>
+#include <QtMath>
+#include <QVector>
+#include <algorithm>
+
+// Count, mean and sum of squared deviations of a stream of values
+// (Welford's algorithm). Partial results of several threads are combined
+// with merge().
+class RunningStats
+{
+public:
+	RunningStats() : n(0), m(0), m2(0) {}
+
+	void add(qreal x)
+	{
+		n++;
+		qreal delta = x - m;
+		m += delta / n;
+		m2 += delta * (x - m);
+	}
+
+	void merge(const RunningStats& other)
+	{
+		if (other.n == 0)
+			return;
+		int total = n + other.n;
+		qreal delta = other.m - m;
+		m += delta * other.n / total;
+		m2 += other.m2 + delta * delta * n * other.n / total;
+		n = total;
+	}
+
+	int count() const { return n; }
+	qreal mean() const { return m; }
+	qreal variance() const { return n > 1 ? m2 / (n - 1) : 0; }
+	qreal standardDeviation() const { return qSqrt(variance()); }
+	qreal standardError() const { return n > 0 ? qSqrt(variance() / n) : 0; }
+
+private:
+	int n;
+	qreal m;
+	qreal m2;
+};
+
+// The 5, 25, 50, 75 and 95 percent quantiles of a population.
+struct Quantiles
+{
+	enum { Count = 5 };
+	qreal value[Count];
+
+	static qreal probability(int i)
+	{
+		static const qreal p[Count] = { 0.05, 0.25, 0.5, 0.75, 0.95 };
+		return p[i];
+	}
+};
+
+// How far the members' time averages are from the ensemble average at one
+// sample, relative to it: the mean and the largest distance, and the
+// fraction of the members within the tolerance.
+struct Divergence
+{
+	enum { Mean, Worst, Within, Count };
+	qreal value[Count];
+};
+
+// Streaming sketch of the Quantiles (the KLL sketch of Karnin, Lang and
+// Liberty): level h holds values standing for 2^h each. A level which fills
+// up is sorted and every other value moves up a level, from an offset which
+// alternates between compactions. The capacities shrink by 2/3 per level
+// below the top one, so the memory is O(K) whatever the population, and the
+// rank error is a fraction of a percent at K = 200. Partial sketches of
+// several threads are combined with merge(), which keeps the same bound
+// whatever the parts; populations below K are kept whole and exact.
+class QuantileSketch
+{
+public:
+	enum { K = 200 };
+
+	QuantileSketch() : n(0), odd(false), levels(1) {}
+
+	void add(qreal x)
+	{
+		levels[0].append(x);
+		n++;
+		compress();
+	}
+
+	void merge(const QuantileSketch& other)
+	{
+		if (other.levels.size() > levels.size())
+			levels.resize(other.levels.size());
+		for (int h = 0; h < other.levels.size(); h++)
+			levels[h] += other.levels[h];
+		n += other.n;
+		compress();
+	}
+
+	qint64 count() const { return n; }
+
+	Quantiles quantiles() const
+	{
+		Quantiles result;
+		QVector<Weighted> all;
+		for (int h = 0; h < levels.size(); h++)
+			for (int i = 0; i < levels[h].size(); i++) {
+				Weighted item = { levels[h][i], qint64(1) << h };
+				all.append(item);
+			}
+		std::sort(all.begin(), all.end(), [](const Weighted& a, const Weighted& b) {
+			return a.value < b.value;
+		});
+		qint64 total = 0;
+		for (int i = 0; i < all.size(); i++)
+			total += all[i].weight;
+		for (int q = 0; q < Quantiles::Count; q++) {
+			// the first value whose cumulative weight passes p of the total
+			qreal rank = Quantiles::probability(q) * total;
+			qint64 below = 0;
+			int i = 0;
+			while (i < all.size() - 1 && below + all[i].weight <= rank)
+				below += all[i++].weight;
+			result.value[q] = all.isEmpty() ? 0 : all[i].value;
+		}
+		return result;
+	}
+
+private:
+	struct Weighted
+	{
+		qreal value;
+		qint64 weight;
+	};
+
+	int capacity(int h) const
+	{
+		int depth = levels.size() - 1 - h;
+		return qMax(2, int(qCeil(K * qPow(2.0 / 3, depth))));
+	}
+
+	void compress()
+	{
+		for (int h = 0; h < levels.size(); h++) {
+			if (levels[h].size() < capacity(h))
+				continue;
+			if (h + 1 == levels.size())
+				levels.resize(h + 2);
+			QVector<qreal>& level = levels[h];
+			std::sort(level.begin(), level.end());
+			// an odd value out stays behind
+			int even = level.size() & ~1;
+			for (int i = odd ? 1 : 0; i < even; i += 2)
+				levels[h + 1].append(level[i]);
+			odd = !odd;
+			if (even < level.size())
+				level[0] = level.last();
+			level.resize(level.size() - even);
+		}
+	}
+
+	qint64 n;
+	bool odd;	// offset of the next compaction
+	QVector<QVector<qreal> > levels;
+};
+
+// Counts of values in equal bins over [from, to); values outside fall into
+// the first or the last bin. Partial histograms over the same bins are
+// combined with merge().
+class Histogram
+{
+public:
+	Histogram() : from(0), width(1) {}
+
+	Histogram(qreal from, qreal to, int bins)
+		: from(from), width(to > from ? (to - from) / qMax(1, bins) : 1), counts(qMax(1, bins), 0) {}
+
+	// Bins over [0, largest value] holding the values given.
+	static Histogram of(const QVector<qreal>& values, int bins)
+	{
+		qreal to = 0;
+		for (int i = 0; i < values.size(); i++)
+			to = qMax(to, values[i]);
+		Histogram h(0, to * (1 + 1e-9), bins);
+		for (int i = 0; i < values.size(); i++)
+			h.add(values[i]);
+		return h;
+	}
+
+	void add(qreal x, qint64 n = 1)
+	{
+		if (counts.isEmpty())
+			return;
+		int i = int(qFloor((x - from) / width));
+		counts[qBound(0, i, counts.size() - 1)] += n;
+	}
+
+	void merge(const Histogram& other)
+	{
+		if (counts.isEmpty()) {
+			*this = other;
+			return;
+		}
+		for (int i = 0; i < counts.size() && i < other.counts.size(); i++)
+			counts[i] += other.counts[i];
+	}
+
+	void clear() { counts.fill(0); }
+
+	int bins() const { return counts.size(); }
+	qint64 count(int i) const { return counts[i]; }
+	qint64 total() const
+	{
+		qint64 sum = 0;
+		for (int i = 0; i < counts.size(); i++)
+			sum += counts[i];
+		return sum;
+	}
+	qreal lower(int i) const { return from + i * width; }
+	qreal center(int i) const { return from + (i + 0.5) * width; }
+	qreal binWidth() const { return width; }
+
+private:
+	qreal from;
+	qreal width;
+	QVector<qint64> counts;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QThread>
+#include "topology.h"
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+QVector<int> parseCpuList(const QString& list)
+{
+	QVector<int> cpus;
+	QStringList ranges = list.trimmed().split(',');
+	for (int i = 0; i < ranges.size(); i++) {
+		QStringList bounds = ranges[i].split('-');
+		bool okFirst, okLast;
+		int first = bounds.first().toInt(&okFirst);
+		int last = bounds.last().toInt(&okLast);
+		if (!okFirst || !okLast)
+			continue;
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.append(cpu);
+	}
+	return cpus;
+}
+
+static QVector<NumaNode> sysfsTopology()
+{
+	QVector<NumaNode> nodes;
+	QDir dir("/sys/devices/system/node");
+	QStringList entries = dir.entryList(QStringList() << "node*", QDir::Dirs);
+	for (int i = 0; i < entries.size(); i++) {
+		bool ok;
+		int id = entries[i].mid(4).toInt(&ok);
+		if (!ok)
+			continue;
+		QFile file(dir.filePath(entries[i] + "/cpulist"));
+		if (!file.open(QIODevice::ReadOnly))
+			continue;
+		NumaNode node;
+		node.id = id;
+		node.cpus = parseCpuList(QString::fromLatin1(file.readAll()));
+		if (!node.cpus.isEmpty())
+			nodes.append(node);
+	}
+	return nodes;
+}
+
+#ifdef HAVE_LIBNUMA
+static QVector<NumaNode> libnumaTopology()
+{
+	QVector<NumaNode> nodes;
+	if (numa_available() < 0)
+		return nodes;
+	struct bitmask *mask = numa_allocate_cpumask();
+	for (int id = 0; id <= numa_max_node(); id++) {
+		if (numa_node_to_cpus(id, mask) < 0)
+			continue;
+		NumaNode node;
+		node.id = id;
+		for (unsigned int cpu = 0; cpu < mask->size; cpu++)
+			if (numa_bitmask_isbitset(mask, cpu))
+				node.cpus.append(cpu);
+		if (!node.cpus.isEmpty())
+			nodes.append(node);
+	}
+	numa_free_cpumask(mask);
+	return nodes;
+}
+#endif
+
+QVector<NumaNode> detectTopology()
+{
+	QVector<NumaNode> nodes;
+#ifdef HAVE_LIBNUMA
+	nodes = libnumaTopology();
+#endif
+	if (nodes.isEmpty())
+		nodes = sysfsTopology();
+	if (nodes.isEmpty()) {
+		NumaNode node;
+		node.id = 0;
+		for (int cpu = 0; cpu < QThread::idealThreadCount(); cpu++)
+			node.cpus.append(cpu);
+		nodes.append(node);
+	}
+	return nodes;
+}
+
+QVector<NumaNode> restrictTopology(const QVector<NumaNode>& nodes, const QVector<int>& cpus)
+{
+	if (cpus.isEmpty())
+		return nodes;
+	QVector<NumaNode> result;
+	for (int i = 0; i < nodes.size(); i++) {
+		NumaNode node;
+		node.id = nodes[i].id;
+		for (int j = 0; j < nodes[i].cpus.size(); j++)
+			if (cpus.contains(nodes[i].cpus[j]))
+				node.cpus.append(nodes[i].cpus[j]);
+		if (!node.cpus.isEmpty())
+			result.append(node);
+	}
+	return result;
+}
+
+bool pinCurrentThread(int cpu)
+{
+#ifdef Q_OS_LINUX
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		return false;
+#ifdef HAVE_LIBNUMA
+	if (numa_available() >= 0)
+		numa_set_localalloc();
+#endif
+	return true;
+#else
+	Q_UNUSED(cpu);
+	return false;
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <QVector>
+#include <QString>
+
+// A NUMA node and the CPUs attached to it.
+struct NumaNode
+{
+	int id;
+	QVector<int> cpus;
+};
+
+// Returns the NUMA nodes of the machine. Uses libnuma when the program is
+// built with CONFIG+=numa, /sys/devices/system/node otherwise, and falls back
+// to a single node holding every CPU.
+QVector<NumaNode> detectTopology();
+
+// Keeps only the CPUs present in the list (an empty list keeps everything)
+// and drops the nodes left without CPUs.
+QVector<NumaNode> restrictTopology(const QVector<NumaNode>& nodes, const QVector<int>& cpus);
+
+// Parses a kernel-style CPU list such as "0-3,8,10-11".
+QVector<int> parseCpuList(const QString& list);
+
+// Binds the calling thread to the CPU and makes it allocate from the local
+// node. Returns false when the platform does not support pinning.
+bool pinCurrentThread(int cpu);
+
+#endif
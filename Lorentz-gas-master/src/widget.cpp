@@ -13,7 +13,9 @@ Widget::Widget(QWidget *parent)
 {
 	showTrace = false;
 	elapsed = 0;
+	current_model = 0;
 	setFixedSize(w, h);
+	ensemble.setDim(w, h);
 
 	vecBegin = QPoint(-1, -1);
 	vecBrush = QBrush(Qt::green);
@@ -21,8 +23,7 @@ Widget::Widget(QWidget *parent)
 
 void Widget::animate()
 {
-    for (int i = 0; i < models.size(); i++)
-        models[i]->step(refresh_rate);
+    ensemble.step(refresh_rate);
 	repaint();
 }
 
@@ -34,29 +35,24 @@ void Widget::setTrace(bool set)
 
 void Widget::paintEvent(QPaintEvent *event)
 {
+    updateCurrentBins();
     painter.begin(this);
 	painter.setRenderHint(QPainter::Antialiasing);
 
-    models[current_model]->paint(&painter, event);
+    getCurrentModel()->paint(&painter, event);
 	if (vecBegin.x() >= 0) {
 		painter.setBrush(vecBrush);
 		painter.drawLine(vecBegin, vecEnd);
 	}
 
 	if (showTrace) {
-		int sum = 0;
-		int step = refresh_rate;
 		int length = trace_length/refresh_rate;
-
-        models[current_model]->save();
-        models[current_model]->setPaintTraceOnly(true);
-		for (int i = 1; i <= length; i++) {
-			sum += step;
-            models[current_model]->step(step);
-            models[current_model]->paint(&painter, event);
-		}
-        models[current_model]->setPaintTraceOnly(false);
-        models[current_model]->load();
+		// only the owning worker may step the member
+		QVector<QPointF> points;
+        ensemble.forMember(current_model, [&points, length](Model *model) {
+            points = model->trace(refresh_rate, length);
+        });
+        getCurrentModel()->paintTrace(&painter, points);
 	}
 
 	painter.end();
@@ -88,10 +84,22 @@ void Widget::mouseReleaseEvent(QMouseEvent *event)
 			angle = (2*M_PI / 360) * (rand() % 360);
 		else
 			angle = (2*M_PI / 360) * (defDir - 90);
-    models[current_model]->add(vecBegin.x(), vecBegin.y(), angle);
+    QPoint at = vecBegin;
+    ensemble.forMember(current_model, [at, angle](Model *model) {
+        model->add(at.x(), at.y(), angle);
+    });
 	vecBegin = QPoint(-1, -1);
 	repaint();
-    numberChanged(models[current_model]->getNumber());
+    numberChanged(getCurrentModel()->getNumber());
+}
+
+// Only the owning worker may change the member, so the GUI thread has it
+// recount the bins before reading them.
+void Widget::updateCurrentBins()
+{
+    ensemble.forMember(current_model, [](Model *model) {
+        model->updateBins();
+    });
 }
 
 QImage Widget::getImage()
@@ -101,28 +109,9 @@ QImage Widget::getImage()
 	return pixmap.toImage();
 }
 
-void Widget::addModel() {
-    Model *model;
-    if (models.size() > 0)
-        model = new Model(*models.back());
-    else {
-        model = new Model();
-        model->setDim(w, h);
-    }
-    models.push_back(model);
-}
-
-void Widget::removeModel() {
-    delete models.back();
-    models.pop_back();
-}
-
 void Widget::setEnsembleSize(int size)
 {
-    while (size > models.size())
-        addModel();
-    while (size < models.size())
-        removeModel();
+    ensemble.setSize(size);
 }
 
 void Widget::setCurrentModel(int idx)
@@ -132,46 +121,79 @@ void Widget::setCurrentModel(int idx)
 
 Model* Widget::getCurrentModel()
 {
-    return models[current_model];
+    return ensemble.getModel(current_model);
 }
 
 Model* Widget::getModel(int idx)
 {
-    return models[idx];
+    return ensemble.getModel(idx);
 }
 
 void Widget::setNumber(int num)
 {
-    for (int i = 0; i < models.size(); i++)
-        models[i]->setNumber(num);
+    ensemble.forEach([num](Model *model) {
+        model->setNumber(num);
+    });
 	repaint();
 }
 
 void Widget::setSide(int val)
 {
-    for (int i = 0; i < models.size(); i++)
-        models[i]->setSide(val);
+    ensemble.forEach([val](Model *model) {
+        model->setSide(val);
+    });
 	repaint();
 }
 
 void Widget::setAtomR(double val)
 {
-    for (int i = 0; i < models.size(); i++)
-        models[i]->setAtomR((qreal)val);
+    ensemble.forEach([val](Model *model) {
+        model->setAtomR((qreal)val);
+    });
 	repaint();
 }
 
 void Widget::setElectronR(double val)
 {
-    for (int i = 0; i < models.size(); i++)
-        models[i]->setElectronR((qreal)val);
+    ensemble.forEach([val](Model *model) {
+        model->setElectronR((qreal)val);
+    });
 	repaint();
 }
 
 void Widget::setSpeed(double val)
 {
-    for (int i = 0; i < models.size(); i++)
-        models[i]->setSpeed(val);
+    ensemble.forEach([val](Model *model) {
+        model->setSpeed(val);
+    });
+	repaint();
+}
+
+void Widget::setBinsNumber(int n)
+{
+    ensemble.setBinsNumber(n);
+	repaint();
+}
+
+void Widget::setAngleBinsNumber(int n)
+{
+    ensemble.setAngleBinsNumber(n);
+	repaint();
+}
+
+void Widget::setBinIndex(int index)
+{
+    ensemble.forEach([index](Model *model) {
+        model->setBinIndex(index);
+    });
+	repaint();
+}
+
+void Widget::setShowBins(bool show)
+{
+    ensemble.forEach([show](Model *model) {
+        model->setShowBins(show);
+    });
 	repaint();
 }
 
@@ -187,8 +209,7 @@ void Widget::setDefaultRandom(bool isRandom)
 
 void Widget::clear()
 {
-    for (int i = 0; i < models.size(); i++)
-        models[i]->clear();
+    ensemble.clear();
 }
 
 
@@ -6,6 +6,8 @@
 #include <QPainter>
 #include <QImage>
 
+#include "ensemble.h"
+
 class Model;
 
 class Widget : public QWidget
@@ -25,15 +27,19 @@ public slots:
 	void setAtomR(double);
     void setElectronR(double);
 	void setDefaultDirection(double);
+	void setBinsNumber(int);
+	void setAngleBinsNumber(int);
+	void setBinIndex(int);
+	void setShowBins(bool);
 
-    void addModel();
-    void removeModel();
     void setEnsembleSize(int);
 
 
     void setCurrentModel(int idx);
     Model* getCurrentModel();
     Model* getModel(int idx);
+    // Brings the bin counts of the current member up to date, on its worker.
+    void updateCurrentBins();
 
     void setDefaultRandom(bool);
 	void setTrace(bool);
@@ -49,7 +55,7 @@ protected:
 	void mouseReleaseEvent(QMouseEvent *event);
 
 public:
-    QVector<Model*> models;
+    Ensemble ensemble;
 
 private:
     QPainter painter;
@@ -6,10 +6,10 @@ using namespace std;
 
 #include "widget.h"
 #include "window.h"
+#include "hugepages.h"
 #include "ui_window.h"
 
 bool equillibrium = false;
-const int equillibrium_detection_len = 20;
 
 Window::Window(QWidget *parent)
 	: QMainWindow(parent),
@@ -41,6 +41,11 @@ Window::Window(QWidget *parent)
     connect(ui->speedBox, SIGNAL(valueChanged(double)), native, SLOT(setSpeed(double)));
     connect(ui->defDirBox, SIGNAL(valueChanged(double)), native, SLOT(setDefaultDirection(double)));
     connect(ui->randomDefDirBox, SIGNAL(toggled(bool)), native, SLOT(setDefaultRandom(bool)));
+    connect(ui->binsBox, SIGNAL(valueChanged(int)), this, SLOT(setBinsNumber(int)));
+    connect(ui->binIndexBox, SIGNAL(valueChanged(int)), native, SLOT(setBinIndex(int)));
+    connect(ui->angleBinsBox, SIGNAL(valueChanged(int)), this, SLOT(setAngleBinsNumber(int)));
+    connect(ui->entropySignalBox, SIGNAL(toggled(bool)), this, SLOT(setEntropySignal(bool)));
+    connect(ui->showBinsBox, SIGNAL(toggled(bool)), native, SLOT(setShowBins(bool)));
 
     native->setNumber(ui->numberBox->value());
     native->setSide(ui->sideBox->value());
@@ -63,6 +68,38 @@ Window::Window(QWidget *parent)
 	plot = new QCustomPlot(this);
 	ui->plotLayout->addWidget(plot);
 
+	// equilibration times of the members
+	histogramPlot = new QCustomPlot(this);
+	histogramPlot->setMaximumHeight(160);
+	ui->plotLayout->addWidget(histogramPlot);
+
+	// distance of the members' time averages from the ensemble average
+	ergodicityPlot = new QCustomPlot(this);
+	ergodicityPlot->setMaximumHeight(160);
+	ui->plotLayout->addWidget(ergodicityPlot);
+
+	// occupancy of the plotted bin, shown while the field is binned
+	densityPlot = new QCustomPlot(this);
+	densityPlot->setMaximumHeight(160);
+	densityPlot->setVisible(false);
+	ui->plotLayout->addWidget(densityPlot);
+
+	// coarse-grained entropy, shown while the phase space is binned
+	entropyPlot = new QCustomPlot(this);
+	entropyPlot->setMaximumHeight(160);
+	entropyPlot->setVisible(false);
+	ui->plotLayout->addWidget(entropyPlot);
+	// directions of the particles, shown while the directions are binned
+	directionPlot = new QCustomPlot(this);
+	directionPlot->setMaximumHeight(160);
+	directionPlot->setVisible(false);
+	ui->plotLayout->addWidget(directionPlot);
+	// free-flight times between scatterer collisions
+	flightPlot = new QCustomPlot(this);
+	flightPlot->setMaximumHeight(160);
+	ui->plotLayout->addWidget(flightPlot);
+	ui->entropySignalBox->setChecked(native->ensemble.getEquilibriumSignal() == Ensemble::Entropy);
+
 	wasRunning = false;
 
 	connect(ui->togglePlayButton, SIGNAL(clicked()), this, SLOT(togglePlay()));
@@ -83,10 +120,45 @@ Window::Window(QWidget *parent)
 
 void Window::setNumber(int newNumber) {
     n_electrons = newNumber;
+    setupEquilibrium();
+    ui->ensembleBox->setToolTip(describeArenas());
+}
+
+void Window::setupEquilibrium() {
+    native->ensemble.setEquilibrium(native->ensemble.defaultDetector(n_electrons));
+}
+
+void Window::setBinsNumber(int n) {
+    native->setBinsNumber(n);
+    ui->binIndexBox->setMaximum(qMax(0, n * n - 1));
+    native->setBinIndex(ui->binIndexBox->value());
+    densityPlot->clearGraphs();
+    densityPlot->setVisible(n > 0);
+    entropyPlot->clearGraphs();
+    entropyPlot->setVisible(native->ensemble.isBinned());
+    setupEquilibrium();
+}
+
+void Window::setAngleBinsNumber(int n) {
+    native->setAngleBinsNumber(n);
+    entropyPlot->clearGraphs();
+    entropyPlot->setVisible(native->ensemble.isBinned());
+    directionPlot->clearGraphs();
+    directionPlot->setVisible(n > 0);
+    setupEquilibrium();
+}
+
+void Window::setEntropySignal(bool entropy) {
+    native->ensemble.setEquilibriumSignal(entropy ? Ensemble::Entropy : Ensemble::Pressure);
+    setupEquilibrium();
 }
 
 void Window::setCurrentEnsembleElement(double new_element) {
     native->setCurrentModel(new_element);
+    if (plot != NULL) {
+        plot->clearGraphs();
+        replot();
+    }
 }
 
 void Window::setEnsembleSize(double new_size) {
@@ -106,144 +178,458 @@ void Window::setEnsembleSize(double new_size) {
         plot->clearGraphs();
         plot->replot();
     }
+    ui->ensembleBox->setToolTip(describeArenas());
 }
 
-template <typename TVec>
-TVec operator-(const TVec& v1, const TVec& v2) {
-    TVec result;
-    for (int i = 0; i < v1.size() && v2.size(); i++)
-        result.push_back(v1[i] - v2[i]);
-    return result;
-}
+// Creates the pressure graphs: the current member (red) with the band of
+// its extremes within every plotted point, the ensemble average (blue), the
+// time average of the current member (green) with its standard error as
+// error bars, the equilibrium line and the
+// 5-95% and 25-75% bands of the ensemble with its median.
+void Window::setupGraphs()
+{
+    plot->yAxis->setLabel("pressure");
+    plot->xAxis->setLabel("t");
 
-template <typename TVec>
-TVec slice(const TVec& vec, int begin, int end) {
-    TVec result;
-    copy(vec.begin() + max(0, begin), vec.begin() + end, back_inserter(result));
-    return result;
-}
+    plot->addGraph();
+    plot->graph(0)->setPen(QPen(QColor(255, 0, 0)));
 
-template <typename TVec>
-TVec averaged(const TVec& vec) {
-    static const int n = 1000000;
-    TVec result;
-    for (int i = 0; i < vec.size(); i++) {
-        double temp = 0.f;
-        for (int j = -i; j <= 0; j++) {
-            temp += vec[max(0, i + j)];
-        }
-        temp /= (i + 1);
-        result.push_back(temp);
-    }
-    return result;
+    plot->addGraph();
+    plot->graph(1)->setPen(QPen(QColor(0, 0, 255)));
+
+    plot->addGraph();
+    plot->graph(2)->setPen(QPen(QColor(0, 255, 0)));
+    plot->graph(2)->setErrorType(QCustomPlotGraph::etValue);
+    plot->graph(2)->setErrorPen(QPen(QColor(0, 160, 0, 80)));
+    plot->graph(2)->setErrorBarSize(2);
+
+    plot->addGraph();
+    plot->graph(3)->setPen(QPen(QColor(255, 0, 0, 60)));
+    plot->addGraph();
+    plot->graph(4)->setPen(QPen(QColor(255, 0, 0, 60)));
+    plot->graph(4)->setBrush(QBrush(QColor(255, 0, 0, 30)));
+    plot->graph(4)->setChannelFillGraph(plot->graph(3));
+
+    plot->addGraph();
+    plot->graph(5)->setPen(QPen(QColor(0, 0, 0)));
+
+    // graphs 6 to 10 follow the quantiles, 5% to 95%; the outer and inner
+    // pairs are filled
+    plot->addGraph();
+    plot->graph(6)->setPen(QPen(QColor(0, 0, 255, 40)));
+    plot->addGraph();
+    plot->graph(7)->setPen(QPen(QColor(0, 0, 255, 60)));
+    plot->addGraph();
+    plot->graph(8)->setPen(QPen(QColor(0, 0, 255), 1, Qt::DashLine));
+    plot->addGraph();
+    plot->graph(9)->setPen(QPen(QColor(0, 0, 255, 60)));
+    plot->graph(9)->setBrush(QBrush(QColor(0, 0, 255, 40)));
+    plot->graph(9)->setChannelFillGraph(plot->graph(7));
+    plot->addGraph();
+    plot->graph(10)->setPen(QPen(QColor(0, 0, 255, 40)));
+    plot->graph(10)->setBrush(QBrush(QColor(0, 0, 255, 20)));
+    plot->graph(10)->setChannelFillGraph(plot->graph(6));
 }
 
-template <typename TVec, typename F>
-TVec fmap(F f, const TVec& vec) {
-    TVec result;
-    for (int i = 0; i < vec.size(); i++) {
-        result.push_back(f(vec[i]));
+// Distance of the time averages from the ensemble average: mean (blue),
+// worst (red) and the fraction within the tolerance (green).
+void Window::replotErgodicity(const QVector<HistoryBucket>& t, int n, qint64 end, int points)
+{
+    if (ergodicityPlot->graphCount() == 0) {
+        ergodicityPlot->xAxis->setLabel("t");
+        ergodicityPlot->yAxis->setLabel("distance");
+        ergodicityPlot->yAxis2->setVisible(true);
+        ergodicityPlot->yAxis2->setLabel("within");
+        ergodicityPlot->yAxis2->setRange(0, 1.05);
+        ergodicityPlot->addGraph();
+        ergodicityPlot->graph(0)->setPen(QPen(QColor(0, 0, 255)));
+        ergodicityPlot->addGraph();
+        ergodicityPlot->graph(1)->setPen(QPen(QColor(255, 0, 0)));
+        ergodicityPlot->addGraph(ergodicityPlot->xAxis, ergodicityPlot->yAxis2);
+        ergodicityPlot->graph(2)->setPen(QPen(QColor(0, 160, 0)));
     }
-    return result;
-}
 
-template <typename TVec, typename F>
-typename TVec::value_type ffold(F f, const TVec& vec) {
-    typename TVec::value_type result = vec[0];
-    for (int i = 1; i < vec.size(); i++) {
-        result = f(result, vec[i]);
+    // lined up with the newest n samples of the pressure plot
+    HistoryView<Divergence> view = native->ensemble.divergenceView();
+    n = qMin(n, view.size());
+    if (n == 0)
+        return;
+    HistoryTail<HistoryView<Divergence> > divergence(view, n);
+    QVector<HistoryBucket> y[Divergence::Count];
+    int m = t.size();
+    for (int k = 0; k < Divergence::Count; k++) {
+        y[k] = native->ensemble.getDivergenceLevels(k).query(divergence, 0, end, points,
+            [k](const Divergence& d) { return d.value[k]; });
+        m = qMin(m, y[k].size());
     }
-    return result;
-}
 
-template <typename TVec>
-bool stop_criteria(const TVec& v1, const TVec& v2, double treshold) {
-    typedef double TVal;
-    static const int n = equillibrium_detection_len;
-    TVec temp = fmap((TVal (*)(TVal))std::fabs, slice(v1, v1.size() - n, v1.size()) - slice(v2, v2.size() - n, v2.size()));
-    return std::accumulate(temp.begin(), temp.end(), 0.0, std::plus<TVal>()) / n < treshold;
+    QVector<double> x(m), value(m);
+    qreal highest = 0;
+    for (int i = 0; i < m; i++)
+        x[i] = t[i].mean();
+    for (int k = 0; k < Divergence::Count; k++) {
+        for (int i = 0; i < m; i++) {
+            value[i] = y[k][i].mean();
+            if (k != Divergence::Within)
+                highest = qMax(highest, value[i]);
+        }
+        ergodicityPlot->graph(k)->setData(x, value);
+    }
+    if (m > 0)
+        ergodicityPlot->xAxis->setRange(t.first().min, t[m - 1].max);
+    ergodicityPlot->yAxis->setRange(0, qMax<qreal>(highest, native->ensemble.getErgodicityTolerance()) * 1.1);
+    ergodicityPlot->setToolTip(native->ensemble.describeErgodicity());
+    ergodicityPlot->replot();
 }
 
-void Window::replot()
+// Share of the particles in the plotted bin: the current member (red), the
+// ensemble (blue) and a uniform spread (dashed).
+void Window::replotDensity(const QVector<HistoryBucket>& t, int n, qint64 end, int points)
 {
-    static double equillibrium_time = -1.0f;
-
-	plot->clearGraphs();
-    QVector<qreal> x, x_cur;
-    QVector<qreal> y, y_avg, y_cur;
-
-    x = native->getCurrentModel()->getTime();
-    y = native->getCurrentModel()->getImpulses();
+    Model *model = native->getCurrentModel();
+    int cells = model->binCount();
+    if (cells == 0)
+        return;
+    if (densityPlot->graphCount() == 0) {
+        densityPlot->xAxis->setLabel("t");
+        densityPlot->yAxis->setLabel("occupancy");
+        densityPlot->addGraph();
+        densityPlot->graph(0)->setPen(QPen(QColor(255, 0, 0)));
+        densityPlot->addGraph();
+        densityPlot->graph(1)->setPen(QPen(QColor(0, 0, 255)));
+        densityPlot->addGraph();
+        densityPlot->graph(2)->setPen(QPen(QColor(0, 0, 0), 1, Qt::DashLine));
+    }
 
-    for (int i = 0; i < x.size(); i++) {
-        y[i] = y[i] / x[i];
+    int bin = model->getBinIndex();
+    CompressedView memberView = model->binView(bin);
+    CompressedView meanView = native->ensemble.binMeanView(bin);
+    n = qMin(n, qMin(memberView.size(), meanView.size()));
+    if (n == 0)
+        return;
+    HistoryTail<CompressedView> member(memberView, n), mean(meanView, n);
+    QVector<HistoryBucket> y = model->binLevels[bin].query(member, 0, end, points);
+    QVector<HistoryBucket> y_avg = native->ensemble.getBinMeanLevels(bin).query(mean, 0, end, points);
+    int m = qMin(t.size(), qMin(y.size(), y_avg.size()));
+    if (m == 0)
+        return;
+
+    QVector<double> x(m), red(m), blue(m);
+    qreal highest = 1.0 / cells;
+    for (int i = 0; i < m; i++) {
+        x[i] = t[i].mean();
+        red[i] = y[i].mean();
+        blue[i] = y_avg[i].mean();
+        highest = qMax(highest, qMax(red[i], blue[i]));
     }
+    densityPlot->graph(0)->setData(x, red);
+    densityPlot->graph(1)->setData(x, blue);
+    QVector<double> uniform_x, uniform_y;
+    uniform_x << t.first().min << t[m - 1].max;
+    uniform_y << 1.0 / cells << 1.0 / cells;
+    densityPlot->graph(2)->setData(uniform_x, uniform_y);
+    densityPlot->xAxis->setRange(t.first().min, t[m - 1].max);
+    densityPlot->yAxis->setRange(0, highest * 1.1);
+    densityPlot->replot();
+}
 
-    y_avg.resize(y.size());
-    for (int i = 0; i < y_avg.size(); i++)
-        y_avg[i] = 0;
+// Entropy of the current member (red) and the ensemble (blue) up to ln
+// cells (dashed), with the mean chi-square of the directions (green).
+void Window::replotEntropy(const QVector<HistoryBucket>& t, int n, qint64 end, int points)
+{
+    Model *model = native->getCurrentModel();
+    int cells = model->cellCount();
+    if (cells == 0)
+        return;
+    if (entropyPlot->graphCount() == 0) {
+        entropyPlot->xAxis->setLabel("t");
+        entropyPlot->yAxis->setLabel("entropy");
+        entropyPlot->addGraph();
+        entropyPlot->graph(0)->setPen(QPen(QColor(255, 0, 0)));
+        entropyPlot->addGraph();
+        entropyPlot->graph(1)->setPen(QPen(QColor(0, 0, 255)));
+        entropyPlot->addGraph();
+        entropyPlot->graph(2)->setPen(QPen(QColor(0, 0, 0), 1, Qt::DashLine));
+        entropyPlot->yAxis2->setVisible(model->getAngleBinsNumber() > 0);
+        entropyPlot->yAxis2->setLabel("chi-square");
+        entropyPlot->addGraph(entropyPlot->xAxis, entropyPlot->yAxis2);
+        entropyPlot->graph(3)->setPen(QPen(QColor(0, 160, 0)));
+        entropyPlot->addGraph(entropyPlot->xAxis, entropyPlot->yAxis2);
+        entropyPlot->graph(4)->setPen(QPen(QColor(0, 160, 0), 1, Qt::DashLine));
+    }
 
-    for (int i = 0; i < native->models.size(); i++) {
-        x_cur = native->getModel(i)->getTime();
-        y_cur = native->getModel(i)->getImpulses();
-        for (int j = 0; j < y_avg.size() && j < y_cur.size() && j < x_cur.size(); j++) {
-            y_avg[j] += (y_cur[j] / x_cur[j]) / native->models.size();
+    CompressedView memberView = model->entropiesView();
+    CompressedView meanView = native->ensemble.entropyMeanView();
+    n = qMin(n, qMin(memberView.size(), meanView.size()));
+    if (n == 0)
+        return;
+    HistoryTail<CompressedView> member(memberView, n), mean(meanView, n);
+    QVector<HistoryBucket> y = model->entropyLevels.query(member, 0, end, points);
+    QVector<HistoryBucket> y_avg = native->ensemble.getEntropyMeanLevels().query(mean, 0, end, points);
+    int m = qMin(t.size(), qMin(y.size(), y_avg.size()));
+    if (m == 0)
+        return;
+
+    QVector<double> x(m), red(m), blue(m);
+    qreal highest = log(qreal(cells));
+    qreal lowest = highest;
+    for (int i = 0; i < m; i++) {
+        x[i] = t[i].mean();
+        red[i] = y[i].mean();
+        blue[i] = y_avg[i].mean();
+        lowest = qMin(lowest, qMin(red[i], blue[i]));
+    }
+    entropyPlot->graph(0)->setData(x, red);
+    entropyPlot->graph(1)->setData(x, blue);
+    QVector<double> top_x, top_y;
+    top_x << t.first().min << t[m - 1].max;
+    top_y << highest << highest;
+    entropyPlot->graph(2)->setData(top_x, top_y);
+    entropyPlot->xAxis->setRange(t.first().min, t[m - 1].max);
+    qreal gap = qMax<qreal>((highest - lowest) * 0.05, 0.01);
+    entropyPlot->yAxis->setRange(lowest - gap, highest + gap);
+
+    int angles = model->getAngleBinsNumber();
+    CompressedView isotropyView = native->ensemble.isotropyMeanView();
+    n = qMin(n, isotropyView.size());
+    if (angles > 0 && n > 0) {
+        HistoryTail<CompressedView> isotropy(isotropyView, n);
+        QVector<HistoryBucket> y_chi2 = native->ensemble.getIsotropyMeanLevels().query(isotropy, 0, end, points);
+        int k = qMin(m, y_chi2.size());
+        QVector<double> green(k);
+        qreal expected = angles - 1;
+        qreal top = 2 * expected;
+        for (int i = 0; i < k; i++) {
+            green[i] = y_chi2[i].mean();
+            top = qMax(top, green[i]);
         }
-
+        entropyPlot->graph(3)->setData(x.mid(0, k), green);
+        QVector<double> expected_y;
+        expected_y << expected << expected;
+        entropyPlot->graph(4)->setData(top_x, expected_y);
+        entropyPlot->yAxis2->setRange(0, top * 1.1);
     }
-    plot->yAxis->setLabel("pressure");
+    entropyPlot->replot();
+}
 
+// Directions pooled over the samples (black) and of the current member
+// (red); the tooltip has the members' chi-square, not the pooled one.
+void Window::replotDirections()
+{
+    const Histogram& pooled = native->ensemble.directionHistogram();
+    native->updateCurrentBins();
+    Model *model = native->getCurrentModel();
+    const QVector<int>& current = model->directions();
+    if (current.isEmpty() || pooled.bins() != current.size() || pooled.total() == 0)
+        return;
+    if (directionPlot->graphCount() == 0) {
+        directionPlot->xAxis->setLabel("direction");
+        directionPlot->yAxis->setLabel("fraction");
+        directionPlot->addGraph();
+        directionPlot->graph(0)->setPen(QPen(QColor(0, 0, 0)));
+        directionPlot->graph(0)->setBrush(QBrush(QColor(0, 0, 0, 40)));
+        directionPlot->graph(0)->setLineStyle(QCustomPlotGraph::lsStepCenter);
+        directionPlot->addGraph();
+        directionPlot->graph(1)->setPen(QPen(QColor(255, 0, 0)));
+        directionPlot->graph(1)->setLineStyle(QCustomPlotGraph::lsStepCenter);
+    }
 
-    plot->xAxis->setLabel("t");
+    int bins = pooled.bins();
+    QVector<double> x(bins), all(bins), member(bins);
+    qreal highest = 1.0 / bins;
+    for (int a = 0; a < bins; a++) {
+        x[a] = pooled.center(a);
+        all[a] = qreal(pooled.count(a)) / pooled.total();
+        member[a] = model->getNumber() > 0 ? qreal(current[a]) / model->getNumber() : 0;
+        highest = qMax(highest, qMax(all[a], member[a]));
+    }
+    directionPlot->graph(0)->setData(x, all);
+    directionPlot->graph(1)->setData(x, member);
+    directionPlot->xAxis->setRange(0, 2 * M_PI);
+    directionPlot->yAxis->setRange(0, highest * 1.1);
+    CompressedView isotropy = native->ensemble.isotropyMeanView();
+    if (!isotropy.isEmpty())
+        directionPlot->setToolTip(QString("mean chi-square of the members %1 with %2 degrees of freedom")
+            .arg(isotropy.last()).arg(bins - 1));
+    directionPlot->replot();
+}
 
-    plot->addGraph();
-    plot->graph(0)->setData(x, y);
-    plot->graph(0)->setPen(QPen(QColor(255, 0, 0)));
+// Free-flight times of the current member, with its collision statistics
+// in the tooltip.
+void Window::replotFlights()
+{
+    Model *model = native->getCurrentModel();
+    const Histogram& h = model->flightHistogram();
+    if (h.bins() == 0 || h.total() == 0)
+        return;
+    if (flightPlot->graphCount() == 0) {
+        flightPlot->xAxis->setLabel("free flight t");
+        flightPlot->yAxis->setLabel("fraction");
+        flightPlot->addGraph();
+        flightPlot->graph(0)->setPen(QPen(QColor(0, 0, 255)));
+        flightPlot->graph(0)->setBrush(QBrush(QColor(0, 0, 255, 40)));
+        flightPlot->graph(0)->setLineStyle(QCustomPlotGraph::lsStepCenter);
+    }
 
-    plot->addGraph();
-    plot->graph(1)->setData(x, y_avg);
-    plot->graph(1)->setPen(QPen(QColor(0, 0, 255)));
+    QVector<double> x(h.bins()), y(h.bins());
+    qreal highest = 0;
+    for (int b = 0; b < h.bins(); b++) {
+        x[b] = h.center(b);
+        y[b] = qreal(h.count(b)) / h.total();
+        highest = qMax(highest, y[b]);
+    }
+    flightPlot->graph(0)->setData(x, y);
+    flightPlot->xAxis->setRange(h.lower(0), h.lower(h.bins()));
+    flightPlot->yAxis->setRange(0, highest * 1.1);
+    flightPlot->setToolTip(model->describeCollisions());
+    flightPlot->replot();
+}
 
-    plot->addGraph();
-    plot->graph(2)->setData(x, averaged(y));
-    plot->graph(2)->setPen(QPen(QColor(0, 255, 0)));
+// Draws the distribution of the equilibration times over the members.
+void Window::replotHistogram()
+{
+    if (histogramPlot->graphCount() == 0) {
+        histogramPlot->xAxis->setLabel("t");
+        histogramPlot->yAxis->setLabel("members");
+        histogramPlot->addGraph();
+        histogramPlot->graph(0)->setPen(QPen(QColor(0, 0, 0)));
+        histogramPlot->graph(0)->setBrush(QBrush(QColor(0, 0, 0, 40)));
+        histogramPlot->graph(0)->setLineStyle(QCustomPlotGraph::lsStepCenter);
+    }
 
-    if (equillibrium) {
-        plot->dumpObjectInfo();
-        plot->addGraph();
-        plot->graph(3)->setPen(QPen(QColor(0, 0, 0)));
-        double min_y = ffold(std::min<double>, y);
-        double max_y = ffold(std::max<double>, y_avg);
-        QVector<double> vline_x, vline_y;
-        vline_x.push_back(equillibrium_time);
-        vline_x.push_back(equillibrium_time);
-        vline_y.push_back(min_y);
-        vline_y.push_back(max_y);
-        plot->graph(3)->setData(vline_x, vline_y);
+    Histogram h = native->ensemble.equilibrationHistogram(histogram_bins);
+    QVector<double> x(h.bins()), count(h.bins());
+    qint64 highest = 1;
+    for (int i = 0; i < h.bins(); i++) {
+        x[i] = h.center(i);
+        count[i] = h.count(i);
+        highest = qMax(highest, h.count(i));
     }
+    histogramPlot->graph(0)->setData(x, count);
+    histogramPlot->xAxis->setRange(0, h.lower(h.bins()));
+    histogramPlot->yAxis->setRange(0, highest * 1.1);
+    histogramPlot->replot();
+}
 
+void Window::replot()
+{
+    // views straight into the histories; only the plot buffers are filled
+    Model *model = native->getCurrentModel();
+    CompressedView timeView = native->ensemble.timeView();
+    CompressedView pressuresView = model->pressuresView();
+    CompressedView averagedView = model->timeAveragedView();
+    CompressedView errorsView = model->averagedErrorsView();
+    HistoryView<RunningStats> statsView = native->ensemble.statsView();
+    HistoryView<Quantiles> quantilesView = native->ensemble.quantilesView();
+    // the histories in RAM drop old samples a block at a time, so sample i
+    // is the same in all of them; those in files drop nothing, and lining
+    // up the newest samples covers a mix of the two
+    int n = qMin(qMin(timeView.size(), pressuresView.size()), qMin(averagedView.size(), statsView.size()));
+    n = qMin(n, qMin(quantilesView.size(), errorsView.size()));
+    if (n == 0)
+        return;
+    HistoryTail<CompressedView> time(timeView, n), pressures(pressuresView, n), averaged(averagedView, n),
+        errors(errorsView, n);
+    HistoryTail<HistoryView<RunningStats> > stats(statsView, n);
+    HistoryTail<HistoryView<Quantiles> > quantiles(quantilesView, n);
+
+    if (plot->graphCount() == 0)
+        setupGraphs();
+
+    qint64 end = native->ensemble.samplesTaken();
+
+    // the curves get a bucket per pixel or so, whatever the run length;
+    // samples beyond the full-resolution history come from coarser levels
+    int points = qMax(1, plot->width());
+    QVector<HistoryBucket> t = native->ensemble.getTimeLevels().query(time, 0, end, points);
+    QVector<HistoryBucket> y = model->pressureLevels.query(pressures, 0, end, points);
+    QVector<HistoryBucket> y_avg = native->ensemble.getMeanLevels().query(stats, 0, end, points,
+        [](const RunningStats& s) { return s.mean(); });
+    QVector<HistoryBucket> y_time = model->averagedLevels.query(averaged, 0, end, points);
+    QVector<HistoryBucket> y_err = model->errorLevels.query(errors, 0, end, points);
+    QVector<HistoryBucket> y_q[Quantiles::Count];
+    int m = qMin(qMin(t.size(), y.size()), qMin(y_avg.size(), y_time.size()));
+    m = qMin(m, y_err.size());
+    for (int q = 0; q < Quantiles::Count; q++) {
+        y_q[q] = native->ensemble.getQuantileLevels(q).query(quantiles, 0, end, points,
+            [q](const Quantiles& v) { return v.value[q]; });
+        m = qMin(m, y_q[q].size());
+    }
+    if (m == 0)
+        return;
+
+    QVector<double> x(m), red(m), blue(m), green(m), green_err(m), low(m), high(m);
+    qreal ymin = 100500.0;
+    qreal ymax = -100500.0;
+    for (int i = 0; i < m; i++) {
+        x[i] = t[i].mean();
+        red[i] = y[i].mean();
+        blue[i] = y_avg[i].mean();
+        green[i] = y_time[i].mean();
+        green_err[i] = y_err[i].mean();
+        low[i] = y[i].min;
+        high[i] = y[i].max;
+        ymin = qMin(ymin, low[i]);
+        ymax = qMax(ymax, high[i]);
+    }
+    plot->graph(0)->setData(x, red);
+    plot->graph(1)->setData(x, blue);
+    plot->graph(2)->setDataValueError(x, green, green_err);
+    plot->graph(3)->setData(x, low);
+    plot->graph(4)->setData(x, high);
+
+    // the bands are drawn through the bucket means of each quantile
+    for (int q = 0; q < Quantiles::Count; q++) {
+        QVector<double> band(m);
+        for (int i = 0; i < m; i++)
+            band[i] = y_q[q][i].mean();
+        plot->graph(6 + q)->setData(x, band);
+    }
 
+    // every member's detector is fed by the ensemble as it samples
+    const EquilibriumDetector& detector = model->detector;
+    if (detector.reached()) {
+        QVector<double> vline_x, vline_y;
+        vline_x.push_back(detector.time());
+        vline_x.push_back(detector.time());
+        vline_y.push_back(ymin);
+        vline_y.push_back(ymax);
+        plot->graph(5)->setData(vline_x, vline_y);
+    }
 
-    if (stop_criteria(y, y_avg, 0.03*n_electrons) && y.size() > equillibrium_detection_len && !equillibrium) {
+    QString state = QString::fromWCharArray(L"Равновесие не достигнуто");
+    if (detector.reached()) {
+        state = QString::fromWCharArray(L"Равновесие достигнуто при t=") + QString::number(detector.time()) + "c";
+        if (detector.confidence() > 0)
+            state += QString::fromWCharArray(L" (%1, %2% на один тест)")
+                .arg(EquilibriumDetector::methodName(detector.getMethod()))
+                .arg(qRound(detector.confidence() * 100));
+    }
+    state += QString::fromWCharArray(L"; в равновесии %1 из %2")
+        .arg(native->ensemble.equilibratedCount()).arg(native->ensemble.size());
+    ui->equilib->setText(state);
+
+    // pause once the chosen fraction of the members is there, only the
+    // first time
+    if (native->ensemble.isEquilibrated() && !equillibrium) {
+        if (timer->isActive())
+            togglePlay();
         equillibrium = true;
-        equillibrium_time = x[x.size() - equillibrium_detection_len];
-        ui->equilib->setText(QString::fromWCharArray(L"Равновесие достигнуто при t=") + QString::number(equillibrium_time) + "c");
-        togglePlay();
     }
+    replotHistogram();
+    replotErgodicity(t, n, end, points);
+    if (densityPlot->isVisible())
+        replotDensity(t, n, end, points);
+    if (entropyPlot->isVisible())
+        replotEntropy(t, n, end, points);
+    if (directionPlot->isVisible())
+        replotDirections();
+    replotFlights();
+
+	plot->xAxis->setRange(t.first().min, t.last().max);
+	plot->setToolTip(native->ensemble.describeHistory() + "\n" + model->describeCorrelation()
+		+ "\n" + model->describeCollisions());
 
-
-	qreal xmax = x.last();
-	qreal xmin = x.first();
-	plot->xAxis->setRange(xmin, xmax);
-
-	qreal ymax = -100500.0;
-	qreal ymin = 100500.0;
-	for (int i = 0; i < y.size(); i++) {
-        if (y[i] > ymax)
-            ymax = y[i];
-        if (y[i] < ymin)
-            ymin = y[i];
-	}
 	qreal gap = (ymax-ymin)*0.05;
 
     plot->yAxis->setRange(ymin-gap, ymax+gap);
@@ -286,6 +672,30 @@ void Window::clearSettings()
         plot->yAxis->setRange(0, 1);
         plot->replot();
     }
+    if (histogramPlot != NULL) {
+        histogramPlot->clearGraphs();
+        histogramPlot->replot();
+    }
+    if (ergodicityPlot != NULL) {
+        ergodicityPlot->clearGraphs();
+        ergodicityPlot->replot();
+    }
+    if (densityPlot != NULL) {
+        densityPlot->clearGraphs();
+        densityPlot->replot();
+    }
+    if (entropyPlot != NULL) {
+        entropyPlot->clearGraphs();
+        entropyPlot->replot();
+    }
+    if (directionPlot != NULL) {
+        directionPlot->clearGraphs();
+        directionPlot->replot();
+    }
+    if (flightPlot != NULL) {
+        flightPlot->clearGraphs();
+        flightPlot->replot();
+    }
     equillibrium = false;
     ui->equilib->setText(QString::fromWCharArray(L"Равновесие не достигнуто"));
 
@@ -9,12 +9,14 @@
 #include <QIntegerForSize>
 
 #include "model.h"
+#include "equilibrium.h"
 #include "widget.h"
 #include "aboutdialog.h"
 #include "qcustomplot.h"
 
 static const int refresh_rate = 50;
 static const int trace_length = 3000;
+static const int histogram_bins = 20;
 
 namespace Ui {
 	class Window;
@@ -30,6 +32,16 @@ public:
 protected:
 	void keyPressEvent(QKeyEvent *event);
 
+protected:
+	void setupGraphs();
+	void replotHistogram();
+	void replotErgodicity(const QVector<HistoryBucket>& t, int n, qint64 end, int points);
+	void replotDensity(const QVector<HistoryBucket>& t, int n, qint64 end, int points);
+	void replotEntropy(const QVector<HistoryBucket>& t, int n, qint64 end, int points);
+	void replotDirections();
+	void replotFlights();
+	void setupEquilibrium();
+
 protected slots:
 	void replot();
 	void saveShot();
@@ -40,6 +52,9 @@ protected slots:
     void setEnsembleSize(double);
 	void trailMode(bool active);
     void setNumber(int);
+    void setBinsNumber(int);
+    void setAngleBinsNumber(int);
+    void setEntropySignal(bool);
 
 private:
 	Ui::Window *ui;
@@ -49,6 +64,12 @@ private:
     QTimer *timer = NULL;
     Widget* native = NULL;
     QCustomPlot* plot = NULL;
+    QCustomPlot* histogramPlot = NULL;
+    QCustomPlot* ergodicityPlot = NULL;
+    QCustomPlot* densityPlot = NULL;
+    QCustomPlot* entropyPlot = NULL;
+    QCustomPlot* directionPlot = NULL;
+    QCustomPlot* flightPlot = NULL;
 
 	AboutDialog *aboutDialog;
 